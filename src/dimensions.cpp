@@ -0,0 +1,99 @@
+#include "dimensions.hpp"
+
+#include <cstring>
+#include <chrono>
+
+#include <spdlog/spdlog.h>
+
+namespace dimensions
+{
+    static MerchantDimension s_merchants;
+
+    template<typename T = uint8_t>
+    T read(const uint8_t*& raw)
+    {
+        T elem;
+        memcpy(&elem, raw, sizeof(T));
+        raw += sizeof(T);
+        return elem;
+    }
+
+    template<>
+    std::string read<std::string>(const uint8_t*& raw)
+    {
+        auto size = read(raw);
+        std::string str((const char*)raw, size);
+        raw += size;
+        return str;
+    }
+
+    MerchantDimension::MerchantDimension(lmdb::env& env)
+    {
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto dbi = lmdb::dbi::open(rtxn, "merchants");
+        auto cursor = lmdb::cursor::open(rtxn, dbi);
+
+        std::vector<Merchant> merchants;
+        std::vector<uint64_t> keys;
+
+        MDB_val key;
+        MDB_val value;
+        bool first = true;
+        while (mdb_cursor_get(cursor, &key, &value, first ? MDB_FIRST : MDB_NEXT) == MDB_SUCCESS)
+        {
+            first = false;
+
+            int64_t id;
+            memcpy(&id, key.mv_data, sizeof(id));
+            auto* raw = (const uint8_t*)value.mv_data;
+
+            Merchant merchant{};
+            merchant.id = id;
+            merchant.name = read<std::string>(raw);
+            merchant.mcc = read<uint32_t>(raw);
+            merchant.category = (models::MerchantCategory)read(raw);
+
+            auto size = read<uint64_t>(raw);
+            merchant.first_location = (uint32_t)p_locations.size();
+            merchant.location_count = (uint32_t)size;
+            for (uint64_t i = 0; i < size; ++i)
+            {
+                auto online = read(raw) == 1;
+                auto foreign = read(raw) == 1;
+                auto zip = read<uint32_t>(raw);
+                auto city = read<std::string>(raw);
+                auto state = read<std::string>(raw);
+
+                p_locations.push_back({ online, foreign, zip, std::move(city), std::move(state) });
+            }
+
+            keys.push_back((uint64_t)id);
+            merchants.push_back(std::move(merchant));
+        }
+
+        cursor.close();
+        rtxn.abort();
+
+        p_index = PerfectHash(keys);
+        p_merchants.resize(merchants.size());
+        for (auto& merchant : merchants)
+        {
+            auto idx = p_index((uint64_t)merchant.id);
+            p_merchants[idx] = std::move(merchant);
+        }
+    }
+
+    void initialize(lmdb::env& env)
+    {
+        auto start = std::chrono::steady_clock::now();
+        s_merchants = MerchantDimension(env);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        spdlog::info("Loaded {} merchants in {}ms", s_merchants.size(), elapsed.count());
+    }
+
+    const MerchantDimension& merchants()
+    {
+        return s_merchants;
+    }
+}
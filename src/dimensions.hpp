@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <lmdb++.h>
+
+#include "models.hpp"
+#include "helpers/perfect_hash.hpp"
+#include "helpers/utilities.hpp"
+
+/**
+ * Read-optimized, in-memory copies of the dimension tables stored in LMDB.
+ *
+ * These are built once at startup and never modified afterwards, so they
+ * can be shared between request threads without any locking.
+ */
+namespace dimensions
+{
+    struct Location
+    {
+        bool online;
+        bool foreign;
+        uint32_t zip;
+        std::string city;
+        std::string state;
+
+        static Location from_online(bool online)
+        {
+            return { online, false, 0, std::string{}, std::string{} };
+        }
+        static Location from_foreign(bool foreign)
+        {
+            return { false, foreign, 0, std::string{}, std::string{} };
+        }
+        static Location from_zip(uint32_t zip)
+        {
+            return { false, false, zip, std::string{}, std::string{} };
+        }
+        static Location from_city(std::string city)
+        {
+            return { false, false, 0, std::move(city), std::string{} };
+        }
+        static Location from_state(std::string state)
+        {
+            return { false, false, 0, std::string{}, std::move(state) };
+        }
+    };
+
+    using LocationList = util::span<const Location>;
+
+    struct Merchant
+    {
+        int64_t id;
+        std::string name;
+        uint32_t mcc;
+        models::MerchantCategory category;
+
+        // Range of this merchant's locations in MerchantDimension's flattened location array
+        uint32_t first_location;
+        uint32_t location_count;
+    };
+
+    class MerchantDimension
+    {
+        PerfectHash p_index;
+        std::vector<Merchant> p_merchants;
+        std::vector<Location> p_locations;
+
+    public:
+        MerchantDimension() = default;
+
+        /**
+         * Reads every merchant out of the `merchants` dbi.
+         *
+         * @param env The LMDB environment holding the `merchants` dbi
+         */
+        explicit MerchantDimension(lmdb::env& env);
+
+        /**
+         * Looks up a merchant by its id.
+         *
+         * @param id The merchant's id
+         * @returns The merchant, or nullptr if there is no merchant with that id
+         */
+        [[nodiscard]] inline const Merchant* find(int64_t id) const noexcept
+        {
+            if (p_merchants.empty())
+                return nullptr;
+
+            const auto& merchant = p_merchants[p_index((uint64_t)id)];
+            return merchant.id == id ? &merchant : nullptr;
+        }
+
+        [[nodiscard]] inline LocationList locations(const Merchant& merchant) const noexcept
+        {
+            return { p_locations.data() + merchant.first_location, merchant.location_count };
+        }
+
+        [[nodiscard]] inline size_t size() const noexcept { return p_merchants.size(); }
+    };
+
+    /**
+     * Builds all of the dimensions, this has to be called once before the
+     * server starts handling requests.
+     *
+     * @param env The LMDB environment to read the dimensions from
+     */
+    void initialize(lmdb::env& env);
+
+    const MerchantDimension& merchants();
+}
@@ -0,0 +1,412 @@
+#include "arrow_writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    // Values from Arrow's Schema.fbs and Message.fbs
+    constexpr int16_t METADATA_V5 = 4;
+    constexpr uint8_t HEADER_SCHEMA = 1;
+    constexpr uint8_t HEADER_RECORD_BATCH = 3;
+
+    constexpr uint8_t TYPE_INT = 2;
+    constexpr uint8_t TYPE_UTF8 = 5;
+    constexpr uint8_t TYPE_BOOL = 6;
+    constexpr uint8_t TYPE_TIMESTAMP = 10;
+    constexpr uint8_t TYPE_LIST = 12;
+
+    constexpr int16_t TIME_UNIT_SECOND = 0;
+
+    constexpr uint32_t CONTINUATION = 0xFFFFFFFF;
+
+    /**
+     * Just enough of a FlatBuffers builder to write Arrow's metadata.
+     *
+     * Like the real builder the buffer is written back to front, so objects
+     * have to be created before anything that refers to them, and an offset
+     * is the number of bytes between an object and the end of the buffer.
+     */
+    class FlatBuilder
+    {
+        std::vector<uint8_t> p_buf;
+        size_t p_min_align = 1;
+        uint32_t p_table_start = 0;
+        std::vector<std::pair<uint16_t, uint32_t>> p_fields;
+
+    public:
+        [[nodiscard]] inline uint32_t size() const noexcept { return (uint32_t)p_buf.size(); }
+
+        void align(size_t alignment, size_t additional = 0)
+        {
+            p_min_align = std::max(p_min_align, alignment);
+            auto padding = (alignment - ((p_buf.size() + additional) % alignment)) % alignment;
+            p_buf.insert(p_buf.begin(), padding, 0);
+        }
+
+        template<typename T>
+        void prepend(T value)
+        {
+            align(sizeof(T));
+            uint8_t bytes[sizeof(T)];
+            memcpy(bytes, &value, sizeof(T));
+            p_buf.insert(p_buf.begin(), bytes, bytes + sizeof(T));
+        }
+
+        void prepend_offset(uint32_t offset)
+        {
+            align(sizeof(uint32_t));
+            prepend<uint32_t>(size() + (uint32_t)sizeof(uint32_t) - offset);
+        }
+
+        uint32_t create_string(const std::string_view& str)
+        {
+            align(sizeof(uint32_t), str.size() + 1);
+            p_buf.insert(p_buf.begin(), 0);
+            p_buf.insert(p_buf.begin(), str.begin(), str.end());
+            prepend<uint32_t>((uint32_t)str.size());
+            return size();
+        }
+
+        uint32_t create_offset_vector(const std::vector<uint32_t>& offsets)
+        {
+            align(sizeof(uint32_t), offsets.size() * sizeof(uint32_t));
+            for (auto it = offsets.rbegin(); it != offsets.rend(); ++it)
+                prepend_offset(*it);
+            prepend<uint32_t>((uint32_t)offsets.size());
+            return size();
+        }
+
+        // Field nodes and buffers are both structs of two longs
+        uint32_t create_struct_vector(const std::vector<int64_t>& pairs)
+        {
+            auto bytes = pairs.size() * sizeof(int64_t);
+            align(sizeof(uint32_t), bytes);
+            align(sizeof(int64_t), bytes);
+            auto* data = (const uint8_t*)pairs.data();
+            p_buf.insert(p_buf.begin(), data, data + bytes);
+            prepend<uint32_t>((uint32_t)(pairs.size() / 2));
+            return size();
+        }
+
+        void start_table()
+        {
+            p_fields.clear();
+            p_table_start = size();
+        }
+
+        template<typename T>
+        void add_field(uint16_t id, T value)
+        {
+            prepend<T>(value);
+            p_fields.emplace_back(id, size());
+        }
+
+        void add_offset_field(uint16_t id, uint32_t offset)
+        {
+            prepend_offset(offset);
+            p_fields.emplace_back(id, size());
+        }
+
+        uint32_t end_table()
+        {
+            prepend<int32_t>(0);
+            auto table = size();
+
+            uint16_t field_count = 0;
+            for (const auto& [id, _] : p_fields)
+                field_count = std::max<uint16_t>(field_count, (uint16_t)(id + 1));
+
+            std::vector<uint16_t> entries(field_count, 0);
+            for (const auto& [id, offset] : p_fields)
+                entries[id] = (uint16_t)(table - offset);
+
+            for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+                prepend<uint16_t>(*it);
+            prepend<uint16_t>((uint16_t)(table - p_table_start));
+            prepend<uint16_t>((uint16_t)(sizeof(uint16_t) * (2 + field_count)));
+
+            auto vtable = size();
+            auto soffset = (int32_t)(vtable - table);
+            memcpy(p_buf.data() + (size() - table), &soffset, sizeof(soffset));
+            return table;
+        }
+
+        std::vector<uint8_t> finish(uint32_t root)
+        {
+            align(std::max<size_t>(p_min_align, sizeof(uint32_t)), sizeof(uint32_t));
+            prepend_offset(root);
+            return std::move(p_buf);
+        }
+    };
+
+    uint32_t create_type(FlatBuilder& fb, ArrowWriter::Type type, uint8_t& type_type)
+    {
+        using Type = ArrowWriter::Type;
+
+        // The timezone has to exist before the table that refers to it
+        uint32_t timezone = 0;
+        if (type == Type::Timestamp)
+            timezone = fb.create_string("UTC");
+
+        fb.start_table();
+        switch (type)
+        {
+            case Type::Bool:
+                type_type = TYPE_BOOL;
+                break;
+            case Type::UInt8:
+            case Type::UInt16:
+            case Type::UInt32:
+            case Type::Int64:
+                type_type = TYPE_INT;
+                fb.add_field<int32_t>(0, type == Type::UInt8 ? 8 : type == Type::UInt16 ? 16 : type == Type::UInt32 ? 32 : 64);
+                fb.add_field<uint8_t>(1, type == Type::Int64 ? 1 : 0);
+                break;
+            case Type::Timestamp:
+                type_type = TYPE_TIMESTAMP;
+                fb.add_offset_field(1, timezone);
+                fb.add_field<int16_t>(0, TIME_UNIT_SECOND);
+                break;
+            case Type::Utf8:
+                type_type = TYPE_UTF8;
+                break;
+            case Type::Utf8List:
+                type_type = TYPE_LIST;
+                break;
+        }
+        return fb.end_table();
+    }
+
+    uint32_t create_field(FlatBuilder& fb, const std::string_view& name, ArrowWriter::Type type)
+    {
+        std::vector<uint32_t> children;
+        if (type == ArrowWriter::Type::Utf8List)
+            children.push_back(create_field(fb, "item", ArrowWriter::Type::Utf8));
+
+        auto name_offset = fb.create_string(name);
+        uint8_t type_type = 0;
+        auto type_offset = create_type(fb, type, type_type);
+        auto children_offset = fb.create_offset_vector(children);
+
+        fb.start_table();
+        fb.add_offset_field(0, name_offset);
+        fb.add_offset_field(3, type_offset);
+        fb.add_offset_field(5, children_offset);
+        fb.add_field<uint8_t>(1, 0);
+        fb.add_field<uint8_t>(2, type_type);
+        return fb.end_table();
+    }
+
+    uint32_t create_message(FlatBuilder& fb, uint8_t header_type, uint32_t header, int64_t body_length)
+    {
+        fb.start_table();
+        fb.add_field<int64_t>(3, body_length);
+        fb.add_offset_field(2, header);
+        fb.add_field<int16_t>(0, METADATA_V5);
+        fb.add_field<uint8_t>(1, header_type);
+        return fb.end_table();
+    }
+
+    size_t value_width(ArrowWriter::Type type)
+    {
+        switch (type)
+        {
+            case ArrowWriter::Type::UInt8: return 1;
+            case ArrowWriter::Type::UInt16: return 2;
+            case ArrowWriter::Type::UInt32: return 4;
+            case ArrowWriter::Type::Int64:
+            case ArrowWriter::Type::Timestamp: return 8;
+            default: return 0;
+        }
+    }
+
+    void append_padded(std::string& out, const void* data, size_t size)
+    {
+        if (size > 0)
+            out.append((const char*)data, size);
+        out.append((8 - out.size() % 8) % 8, '\0');
+    }
+}
+
+ArrowWriter::ArrowWriter(std::vector<Column> columns, sink output, size_t batch_rows)
+    : p_sink(std::move(output)), p_batch_rows(batch_rows)
+{
+    if (!p_sink)
+        throw std::invalid_argument("ArrowWriter needs a sink");
+
+    for (auto& column : columns)
+        p_columns.push_back({ std::move(column), {}, { 0 }, { 0 } });
+
+    write_schema();
+}
+
+ArrowWriter::ColumnData& ArrowWriter::next_column(Type expected)
+{
+    if (p_next_column >= p_columns.size())
+        throw std::logic_error("Too many values for a row");
+
+    auto& data = p_columns[p_next_column++];
+    bool valid = data.column.type == expected || (expected == Type::Int64 && value_width(data.column.type) != 0);
+    if (!valid)
+        throw std::logic_error("Wrong type of value for column " + data.column.name);
+    return data;
+}
+
+void ArrowWriter::append(bool value)
+{
+    next_column(Type::Bool).values.push_back(value ? 1 : 0);
+}
+
+void ArrowWriter::append(int64_t value)
+{
+    auto& data = next_column(Type::Int64);
+    uint8_t bytes[sizeof(value)];
+    memcpy(bytes, &value, sizeof(value));
+    // Little endian, so the narrower types are just the first few bytes
+    data.values.insert(data.values.end(), bytes, bytes + value_width(data.column.type));
+}
+
+void ArrowWriter::append(const std::string_view& value)
+{
+    auto& data = next_column(Type::Utf8);
+    data.values.insert(data.values.end(), value.begin(), value.end());
+    data.offsets.push_back((int32_t)data.values.size());
+}
+
+void ArrowWriter::append(const std::vector<std::string>& values)
+{
+    auto& data = next_column(Type::Utf8List);
+    for (const auto& value : values)
+    {
+        data.values.insert(data.values.end(), value.begin(), value.end());
+        data.offsets.push_back((int32_t)data.values.size());
+    }
+    data.list_offsets.push_back((int32_t)data.offsets.size() - 1);
+}
+
+void ArrowWriter::end_row()
+{
+    if (p_next_column != p_columns.size())
+        throw std::logic_error("Not enough values for a row");
+
+    p_next_column = 0;
+    ++p_rows;
+    ++p_total_rows;
+
+    if (p_rows >= p_batch_rows)
+        write_batch();
+}
+
+void ArrowWriter::finish()
+{
+    if (p_finished)
+        return;
+
+    if (p_rows > 0)
+        write_batch();
+
+    uint32_t eos[2] = { CONTINUATION, 0 };
+    p_sink(std::string_view((const char*)eos, sizeof(eos)));
+    p_finished = true;
+}
+
+void ArrowWriter::write_schema()
+{
+    FlatBuilder fb;
+
+    std::vector<uint32_t> fields;
+    for (const auto& data : p_columns)
+        fields.push_back(create_field(fb, data.column.name, data.column.type));
+    auto fields_offset = fb.create_offset_vector(fields);
+
+    fb.start_table();
+    fb.add_offset_field(1, fields_offset);
+    fb.add_field<int16_t>(0, 0);
+    auto schema = fb.end_table();
+
+    write_message(fb.finish(create_message(fb, HEADER_SCHEMA, schema, 0)), std::string{});
+}
+
+void ArrowWriter::write_batch()
+{
+    std::string body;
+    std::vector<int64_t> nodes;
+    std::vector<int64_t> buffers;
+
+    auto add_buffer = [&body, &buffers](const void* data, size_t size) {
+        buffers.push_back((int64_t)body.size());
+        buffers.push_back((int64_t)size);
+        append_padded(body, data, size);
+    };
+    auto add_node = [&nodes](size_t length) {
+        nodes.push_back((int64_t)length);
+        nodes.push_back(0);
+    };
+
+    for (auto& data : p_columns)
+    {
+        add_node(p_rows);
+        // None of the values are ever null, so the validity bitmaps are left out
+        add_buffer(nullptr, 0);
+
+        switch (data.column.type)
+        {
+            case Type::Bool:
+            {
+                std::vector<uint8_t> bits((p_rows + 7) / 8, 0);
+                for (size_t i = 0; i < p_rows; ++i)
+                    bits[i / 8] |= (uint8_t)(data.values[i] << (i % 8));
+                add_buffer(bits.data(), bits.size());
+                break;
+            }
+            case Type::Utf8:
+                add_buffer(data.offsets.data(), data.offsets.size() * sizeof(int32_t));
+                add_buffer(data.values.data(), data.values.size());
+                break;
+            case Type::Utf8List:
+                add_buffer(data.list_offsets.data(), data.list_offsets.size() * sizeof(int32_t));
+                add_node(data.offsets.size() - 1);
+                add_buffer(nullptr, 0);
+                add_buffer(data.offsets.data(), data.offsets.size() * sizeof(int32_t));
+                add_buffer(data.values.data(), data.values.size());
+                break;
+            default:
+                add_buffer(data.values.data(), data.values.size());
+                break;
+        }
+
+        data.values.clear();
+        data.offsets.assign(1, 0);
+        data.list_offsets.assign(1, 0);
+    }
+
+    FlatBuilder fb;
+    auto buffers_offset = fb.create_struct_vector(buffers);
+    auto nodes_offset = fb.create_struct_vector(nodes);
+
+    fb.start_table();
+    fb.add_field<int64_t>(0, (int64_t)p_rows);
+    fb.add_offset_field(1, nodes_offset);
+    fb.add_offset_field(2, buffers_offset);
+    auto batch = fb.end_table();
+
+    write_message(fb.finish(create_message(fb, HEADER_RECORD_BATCH, batch, (int64_t)body.size())), body);
+    p_rows = 0;
+}
+
+void ArrowWriter::write_message(const std::vector<uint8_t>& metadata, const std::string& body)
+{
+    std::string message;
+    message.reserve(8 + metadata.size() + 8 + body.size());
+
+    auto padded = (uint32_t)((metadata.size() + 7) / 8 * 8);
+    message.append((const char*)&CONTINUATION, sizeof(CONTINUATION));
+    message.append((const char*)&padded, sizeof(padded));
+    message.append((const char*)metadata.data(), metadata.size());
+    message.append(padded - metadata.size(), '\0');
+    message.append(body);
+
+    p_sink(message);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+/**
+ * Writes columns in the Apache Arrow IPC streaming format
+ * (application/vnd.apache.arrow.stream), a schema message followed by one
+ * record batch per `batch_rows` rows and an end-of-stream marker.
+ *
+ * Values are appended one row at a time into per-column buffers, which are
+ * written out as a record batch whenever enough rows have been collected, so
+ * at most one batch is held in memory.
+ */
+class ArrowWriter
+{
+public:
+    using sink = std::function<void(const std::string_view&)>;
+
+    enum class Type : uint8_t
+    {
+        Bool,
+        UInt8,
+        UInt16,
+        UInt32,
+        Int64,
+        // Seconds since the epoch, in UTC
+        Timestamp,
+        Utf8,
+        Utf8List
+    };
+
+    struct Column
+    {
+        std::string name;
+        Type type;
+    };
+
+    static constexpr size_t DEFAULT_BATCH_ROWS = 64 * 1024;
+
+    /**
+     * @param columns The columns of every row, values have to be appended in this order
+     * @param output Where to send the stream as it's written
+     * @param batch_rows How many rows to put in each record batch
+     */
+    ArrowWriter(std::vector<Column> columns, sink output, size_t batch_rows = DEFAULT_BATCH_ROWS);
+
+    ArrowWriter(const ArrowWriter&) = delete;
+    ArrowWriter& operator=(const ArrowWriter&) = delete;
+
+    void append(bool value);
+    void append(int64_t value);
+    void append(const std::string_view& value);
+    void append(const std::vector<std::string>& values);
+
+    /**
+     * Ends the current row, every column must have had a value appended.
+     */
+    void end_row();
+
+    /**
+     * Writes the last, partial, record batch and the end-of-stream marker.
+     */
+    void finish();
+
+    [[nodiscard]] inline size_t rows() const noexcept { return p_total_rows; }
+
+private:
+    struct ColumnData
+    {
+        Column column;
+        std::vector<uint8_t> values;
+        std::vector<int32_t> offsets;
+        // Offsets into `offsets` for list columns
+        std::vector<int32_t> list_offsets;
+    };
+
+    ColumnData& next_column(Type expected);
+    void write_schema();
+    void write_batch();
+    void write_message(const std::vector<uint8_t>& metadata, const std::string& body);
+
+    std::vector<ColumnData> p_columns;
+    sink p_sink;
+    size_t p_batch_rows;
+    size_t p_rows = 0;
+    size_t p_total_rows = 0;
+    size_t p_next_column = 0;
+    bool p_finished = false;
+};
@@ -0,0 +1,49 @@
+#include "body_response.hpp"
+
+// MHD_create_response_from_buffer_with_free_callback_cls was added in 0.9.73
+#if defined(MHD_VERSION) && MHD_VERSION >= 0x00097300
+#define UTOPIA_MHD_FREE_CALLBACK_CLS
+#endif
+
+#ifdef UTOPIA_MHD_FREE_CALLBACK_CLS
+namespace
+{
+    void release_body(void* cls)
+    {
+        delete (std::shared_ptr<const void>*)cls;
+    }
+}
+#endif
+
+body_response::body_response(std::string body, int response_code, const std::string& content_type)
+    : body_response(std::make_shared<const std::string>(std::move(body)), response_code, content_type)
+{
+}
+
+body_response::body_response(std::shared_ptr<const std::string> body, int response_code, const std::string& content_type)
+    : http_response(response_code, content_type), p_body(*body)
+{
+    p_owner = std::move(body);
+}
+
+body_response::body_response(std::string_view body, std::shared_ptr<const void> owner, int response_code, const std::string& content_type)
+    : http_response(response_code, content_type), p_owner(std::move(owner)), p_body(body)
+{
+}
+
+MHD_Response* body_response::get_raw_response()
+{
+#ifdef UTOPIA_MHD_FREE_CALLBACK_CLS
+    // libmicrohttpd holds its own reference to the body, so it doesn't
+    // matter whether the response or the connection is done with it first
+    auto* owner = new std::shared_ptr<const void>(p_owner);
+    auto* raw = MHD_create_response_from_buffer_with_free_callback_cls(p_body.size(), p_body.data(), &release_body, owner);
+    if (raw == nullptr)
+        delete owner;
+    return raw;
+#else
+    // NOTE: libhttpserver keeps the response alive until the request has
+    //       completed, so the body outlives the MHD_Response anyway.
+    return MHD_create_response_from_buffer(p_body.size(), (void*)p_body.data(), MHD_RESPMEM_PERSISTENT);
+#endif
+}
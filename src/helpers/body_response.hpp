@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <optional>
+
+#include <httpserver.hpp>
+
+/**
+ * A response that owns its body and hands it to libmicrohttpd without
+ * copying it, unlike string_response which copies its content into every
+ * MHD_Response it creates. The body is freed once both the response and
+ * libmicrohttpd are done with it.
+ */
+class body_response : public httpserver::http_response
+{
+public:
+    explicit body_response(std::string body, int response_code = 200, const std::string& content_type = "text/plain");
+
+    /**
+     * Shares a body with whatever else holds it, e.g. the result cache.
+     */
+    body_response(std::shared_ptr<const std::string> body, int response_code, const std::string& content_type);
+
+    /**
+     * A body that lives in memory kept alive by `owner`, e.g. a cache store
+     * read transaction.
+     */
+    body_response(std::string_view body, std::shared_ptr<const void> owner, int response_code, const std::string& content_type);
+
+    MHD_Response* get_raw_response() override;
+
+    [[nodiscard]] inline std::string_view body() const noexcept { return p_body; }
+    [[nodiscard]] inline size_t size() const noexcept { return p_body.size(); }
+    [[nodiscard]] inline const std::shared_ptr<const void>& owner() const noexcept { return p_owner; }
+
+    /**
+     * @returns The CRC-32 of the body if it's already known, e.g. because it
+     *          was read from the cache store
+     */
+    [[nodiscard]] inline std::optional<uint32_t> checksum() const noexcept { return p_checksum; }
+    inline void set_checksum(uint32_t checksum) noexcept { p_checksum = checksum; }
+
+private:
+    std::shared_ptr<const void> p_owner;
+    std::string_view p_body;
+    std::optional<uint32_t> p_checksum;
+};
@@ -0,0 +1,487 @@
+#include "cache_store.hpp"
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+#include <stdexcept>
+#include <cstring>
+#include <ctime>
+
+#include <spdlog/spdlog.h>
+
+#include "utilities.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // "UCS" followed by the version of the entry layout
+    constexpr uint32_t MAGIC = 0x55435302;
+    // No single entry may take more than 1/ENTRY_FRACTION of the budget
+    constexpr size_t ENTRY_FRACTION = 4;
+    // On top of twice the budget, pages freed by an eviction can only be
+    // reused once no reader is looking at them anymore
+    constexpr size_t MAP_SLACK = 64 * 1024 * 1024;
+    // Every response that's being sent out of the store holds a reader slot
+    constexpr unsigned MAX_READERS = 1024;
+
+    // Writes past this many queued bytes are dropped instead of waiting
+    constexpr size_t MAX_QUEUED_SIZE = 256 * 1024 * 1024;
+    // A transaction takes this many writes, or this many bytes, at most
+    constexpr size_t MAX_BATCH_WRITES = 64;
+    constexpr size_t MAX_BATCH_SIZE = 64 * 1024 * 1024;
+
+    /**
+     * Stored in front of every body.
+     */
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t checksum;
+        uint64_t size;
+        int64_t stored_at;
+        uint64_t version;
+    };
+
+    /**
+     * A read transaction that's kept open for as long as a body read in it
+     * is being sent.
+     */
+    struct Snapshot
+    {
+        lmdb::txn txn;
+    };
+
+    std::unique_ptr<CacheStore> s_store;
+
+    uint32_t checksum(const char* data, size_t size)
+    {
+        return util::checksum(std::string_view(data, size));
+    }
+
+    bool parse_header(const MDB_val& value, Header& header)
+    {
+        if (value.mv_size < sizeof(Header))
+            return false;
+
+        // LMDB only aligns values to 2 bytes
+        memcpy(&header, value.mv_data, sizeof(header));
+        return header.magic == MAGIC && header.size == value.mv_size - sizeof(Header);
+    }
+}
+
+CacheStore::SyncPolicy CacheStore::sync_policy(const std::string& name)
+{
+    if (name == "always")
+        return SyncPolicy::Always;
+    else if (name == "periodic")
+        return SyncPolicy::Periodic;
+    else if (name == "never")
+        return SyncPolicy::Never;
+    throw std::invalid_argument("cache sync policy must be always, periodic or never!");
+}
+
+void CacheStore::initialize(const fs::path& path, size_t budget, uint64_t version, SyncPolicy sync)
+{
+    if (budget == 0)
+    {
+        s_store.reset();
+        return;
+    }
+    s_store = std::make_unique<CacheStore>(path, budget, version, sync);
+}
+
+void CacheStore::shutdown()
+{
+    s_store.reset();
+}
+
+CacheStore* CacheStore::get()
+{
+    return s_store.get();
+}
+
+CacheStore::CacheStore(const fs::path& path, size_t budget, uint64_t version, SyncPolicy sync)
+    : p_env(lmdb::env::create()), p_dbi(0), p_budget(budget), p_version(version), p_sync(sync)
+{
+    fs::create_directories(path);
+
+    p_env.set_mapsize(budget * 2 + MAP_SLACK);
+    p_env.set_max_dbs(1);
+    p_env.set_max_readers(MAX_READERS);
+    // NOTE: MDB_NOTLS lets a read transaction end on another thread than the
+    //       one it began on, which is wherever its response is released.
+    p_env.open(path.c_str(), MDB_NOTLS | (sync == SyncPolicy::Always ? 0 : MDB_NOSYNC), 0644);
+
+    auto wtxn = lmdb::txn::begin(p_env);
+    p_dbi = lmdb::dbi::open(wtxn, "responses", MDB_CREATE);
+    wtxn.commit();
+
+    load();
+    p_writer = std::thread([this] { run(); });
+}
+
+CacheStore::~CacheStore()
+{
+    {
+        std::lock_guard lock(p_mutex);
+        p_stopping = true;
+    }
+    p_cv.notify_one();
+    p_writer.join();
+}
+
+void CacheStore::load()
+{
+    struct Found
+    {
+        std::string key;
+        int64_t stored_at;
+        size_t size;
+        uint64_t version;
+    };
+
+    std::vector<Found> found;
+    std::vector<std::string> invalid;
+
+    auto rtxn = lmdb::txn::begin(p_env, nullptr, MDB_RDONLY);
+    auto cursor = lmdb::cursor::open(rtxn, p_dbi);
+
+    MDB_val key;
+    MDB_val value;
+    bool first = true;
+    while (mdb_cursor_get(cursor, &key, &value, first ? MDB_FIRST : MDB_NEXT) == MDB_SUCCESS)
+    {
+        first = false;
+
+        std::string name((const char*)key.mv_data, key.mv_size);
+        Header header{};
+        if (parse_header(value, header))
+            found.push_back({ std::move(name), header.stored_at, header.size, header.version });
+        else
+            invalid.push_back(std::move(name));
+    }
+
+    cursor.close();
+    rtxn.abort();
+
+    // Nothing has been used since the restart, so the oldest entries go first
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.stored_at < b.stored_at; });
+    size_t stale = 0;
+    for (auto& entry : found)
+    {
+        if (entry.version != p_version)
+            ++stale;
+        p_size += entry.size;
+        p_entries.emplace(std::move(entry.key), Metadata { entry.size, ++p_clock, entry.version, false });
+    }
+
+    if (!invalid.empty())
+        spdlog::warn("Dropping {} unreadable entries from the cache store", invalid.size());
+    spdlog::info("Opened the cache store with {} entries ({} bytes), {} from an older dataset", found.size(), p_size, stale);
+
+    // The writer isn't running yet, so this happens before anything is served.
+    // The budget may also have shrunk since the entries were stored.
+    std::vector<Write> batch;
+    for (auto& name : invalid)
+        batch.push_back(Write { std::move(name), {}, nullptr, {}, 0, true });
+    if (!batch.empty() || p_size > p_budget)
+        write_batch(batch);
+}
+
+std::optional<CacheStore::Hit> CacheStore::find(const std::string& key)
+{
+    bool verified;
+    bool stale;
+    {
+        std::lock_guard lock(p_mutex);
+        auto it = p_entries.find(key);
+        if (it == p_entries.end())
+            return std::nullopt;
+
+        it->second.last_used = ++p_clock;
+        verified = it->second.verified;
+        stale = it->second.version != p_version;
+    }
+
+    auto snapshot = std::make_shared<Snapshot>(Snapshot { lmdb::txn::begin(p_env, nullptr, MDB_RDONLY) });
+
+    MDB_val name { key.size(), (void*)key.data() };
+    MDB_val value;
+    // Evicted since it was looked up
+    if (mdb_get(snapshot->txn, p_dbi, &name, &value) != MDB_SUCCESS)
+        return std::nullopt;
+
+    Header header{};
+    const char* body = (const char*)value.mv_data + sizeof(Header);
+    if (!parse_header(value, header) || (!verified && checksum(body, header.size) != header.checksum))
+    {
+        snapshot.reset();
+        spdlog::warn("Dropping the corrupt cache entry \"{}\"", key);
+        remove(key);
+        return std::nullopt;
+    }
+
+    if (!verified)
+    {
+        std::lock_guard lock(p_mutex);
+        auto it = p_entries.find(key);
+        if (it != p_entries.end())
+            it->second.verified = true;
+    }
+
+    return Hit { std::string_view(body, header.size), std::move(snapshot), stale, header.checksum };
+}
+
+bool CacheStore::insert(const std::string& key, const std::string_view& body, std::shared_ptr<const void> owner)
+{
+    return enqueue(Write { key, body, std::move(owner), {}, body.size(), false });
+}
+
+bool CacheStore::insert_file(const std::string& key, const fs::path& file)
+{
+    std::error_code ec;
+    auto size = (size_t)fs::file_size(file, ec);
+    if (!ec && enqueue(Write { key, {}, nullptr, file, size, false }))
+        return true;
+
+    fs::remove(file, ec);
+    return false;
+}
+
+void CacheStore::remove(const std::string& key)
+{
+    {
+        std::lock_guard lock(p_mutex);
+        auto it = p_entries.find(key);
+        if (it != p_entries.end())
+        {
+            p_size -= it->second.size;
+            p_entries.erase(it);
+        }
+    }
+    // Queued even if the entry isn't there, it may be waiting to be written
+    enqueue(Write { key, {}, nullptr, {}, 0, true });
+}
+
+size_t CacheStore::max_entry_size() const noexcept
+{
+    return p_budget / ENTRY_FRACTION;
+}
+
+bool CacheStore::enqueue(Write write)
+{
+    if (write.size > max_entry_size())
+        return false;
+
+    {
+        std::lock_guard lock(p_mutex);
+        if (p_stopping || p_queued_size + write.size > MAX_QUEUED_SIZE)
+            return false;
+
+        p_queued_size += write.size;
+        p_queue.push_back(std::move(write));
+    }
+    p_cv.notify_one();
+    return true;
+}
+
+void CacheStore::run()
+{
+    auto last_sync = std::chrono::steady_clock::now();
+    bool dirty = false;
+
+    std::unique_lock lock(p_mutex);
+    while (true)
+    {
+        auto ready = [this] { return p_stopping || !p_queue.empty(); };
+        if (p_sync == SyncPolicy::Periodic && dirty)
+            p_cv.wait_until(lock, last_sync + SYNC_INTERVAL, ready);
+        else
+            p_cv.wait(lock, ready);
+
+        if (!p_queue.empty())
+        {
+            std::vector<Write> batch;
+            size_t size = 0;
+            while (!p_queue.empty() && batch.size() < MAX_BATCH_WRITES && size < MAX_BATCH_SIZE)
+            {
+                size += p_queue.front().size;
+                batch.push_back(std::move(p_queue.front()));
+                p_queue.pop_front();
+            }
+            p_queued_size -= size;
+
+            lock.unlock();
+            dirty = write_batch(batch) || dirty;
+            lock.lock();
+        }
+        else if (p_stopping)
+        {
+            break;
+        }
+
+        if (p_sync == SyncPolicy::Periodic && dirty && std::chrono::steady_clock::now() - last_sync >= SYNC_INTERVAL)
+        {
+            lock.unlock();
+            p_env.sync(true);
+            lock.lock();
+            last_sync = std::chrono::steady_clock::now();
+            dirty = false;
+        }
+    }
+    lock.unlock();
+
+    if (p_sync != SyncPolicy::Always)
+        p_env.sync(true);
+}
+
+bool CacheStore::write_batch(const std::vector<Write>& batch)
+{
+    // Only the last write to a key counts
+    std::unordered_map<std::string_view, size_t> last;
+    for (size_t i = 0; i < batch.size(); ++i)
+        last[batch[i].key] = i;
+
+    // Evict stale entries and then the least recently used ones until the
+    // batch fits, only this thread can add entries in the meantime
+    std::vector<std::string> evicted;
+    {
+        std::lock_guard lock(p_mutex);
+        auto total = p_size;
+        for (const auto& [key, i] : last)
+        {
+            auto it = p_entries.find(std::string(key));
+            if (it != p_entries.end())
+                total -= it->second.size;
+            if (!batch[i].remove)
+                total += batch[i].size;
+        }
+
+        if (total > p_budget)
+        {
+            std::vector<std::tuple<bool, uint64_t, const std::string*>> candidates;
+            for (const auto& [name, metadata] : p_entries)
+            {
+                if (last.find(name) == last.end())
+                    candidates.emplace_back(metadata.version == p_version, metadata.last_used, &name);
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            for (const auto& candidate : candidates)
+            {
+                if (total <= p_budget)
+                    break;
+                const auto* name = std::get<2>(candidate);
+                total -= p_entries.at(*name).size;
+                evicted.push_back(*name);
+            }
+        }
+    }
+
+    std::vector<bool> written(batch.size(), false);
+    bool committed = false;
+    try
+    {
+        auto wtxn = lmdb::txn::begin(p_env);
+        for (const auto& name : evicted)
+        {
+            MDB_val victim { name.size(), (void*)name.data() };
+            mdb_del(wtxn, p_dbi, &victim, nullptr);
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const auto& write = batch[i];
+            if (last[write.key] != i)
+                continue;
+
+            MDB_val name { write.key.size(), (void*)write.key.data() };
+            if (write.remove)
+            {
+                mdb_del(wtxn, p_dbi, &name, nullptr);
+                continue;
+            }
+
+            MDB_val value { sizeof(Header) + write.size, nullptr };
+            int rc = mdb_put(wtxn, p_dbi, &name, &value, MDB_RESERVE);
+            if (rc != MDB_SUCCESS)
+                lmdb::error::raise("mdb_put", rc);
+
+            auto* body = (char*)value.mv_data + sizeof(Header);
+            if (write.file.empty())
+            {
+                memcpy(body, write.body.data(), write.size);
+            }
+            else
+            {
+                std::ifstream in(write.file, std::ios::in | std::ios::binary);
+                in.read(body, (std::streamsize)write.size);
+                // The reserved space replaced whatever was stored before, so nothing is left
+                if (in.gcount() != (std::streamsize)write.size)
+                {
+                    mdb_del(wtxn, p_dbi, &name, nullptr);
+                    continue;
+                }
+            }
+
+            Header header { MAGIC, checksum(body, write.size), write.size, (int64_t)std::time(nullptr), p_version };
+            memcpy(value.mv_data, &header, sizeof(header));
+            written[i] = true;
+        }
+
+        // NOTE: The batch becomes visible all at once or not at all when it's
+        //       committed, which is what writing to a temporary file and
+        //       renaming it would otherwise be for. LMDB writes the pages out
+        //       itself during the commit, on this thread rather than a request's.
+        wtxn.commit();
+        committed = true;
+    }
+    catch (lmdb::error& ex)
+    {
+        spdlog::error("Failed to write {} entries to the cache store: {}", batch.size(), ex.what());
+    }
+
+    std::error_code ec;
+    for (const auto& write : batch)
+    {
+        if (!write.file.empty())
+            fs::remove(write.file, ec);
+    }
+
+    if (!committed)
+        return false;
+
+    std::lock_guard lock(p_mutex);
+    // NOTE: remove() may have dropped a victim while the lock was released,
+    //       it already took the victim's size off then.
+    for (const auto& name : evicted)
+    {
+        auto it = p_entries.find(name);
+        if (it == p_entries.end())
+            continue;
+        p_size -= it->second.size;
+        p_entries.erase(it);
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        const auto& write = batch[i];
+        if (last[write.key] != i)
+            continue;
+
+        auto it = p_entries.find(write.key);
+        if (it != p_entries.end())
+        {
+            p_size -= it->second.size;
+            p_entries.erase(it);
+        }
+        if (written[i])
+        {
+            p_entries.emplace(write.key, Metadata { write.size, ++p_clock, p_version, true });
+            p_size += write.size;
+        }
+    }
+    return true;
+}
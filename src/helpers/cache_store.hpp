@@ -0,0 +1,180 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <filesystem>
+
+#include <lmdb++.h>
+
+/**
+ * Finished responses kept on disk, in an LMDB environment of their own.
+ *
+ * Which entries exist is tracked in memory, so probing for one that doesn't
+ * exist costs no I/O at all, and a hit is served straight out of the mapping.
+ * Every entry is checksummed and checked the first time it's read after a
+ * restart; entries that don't match are dropped instead of being served.
+ * Entries are also tagged with the version of the dataset they were computed
+ * from, ones from another version are still found but marked stale.
+ *
+ * Writes are queued and made by a thread of their own, a batch of them per
+ * transaction, so requests never wait on the disk. Once the entries add up to
+ * more than the budget, stale and then least recently used ones are evicted
+ * in the same transaction. An entry only becomes visible once it's written.
+ */
+class CacheStore
+{
+public:
+    /**
+     * An entry that was found, the body stays valid as long as `snapshot`
+     * is held (it's the read transaction the body was read in).
+     */
+    struct Hit
+    {
+        std::string_view body;
+        std::shared_ptr<const void> snapshot;
+        // Computed from another version of the dataset
+        bool stale;
+        // The CRC-32 of the body, as it was written
+        uint32_t checksum;
+    };
+
+    /**
+     * When written entries are flushed to the disk. Whatever isn't can be lost
+     * to a crash of the system (not of the server), and on file systems that
+     * reorder writes that can leave the store unreadable until it's deleted.
+     */
+    enum class SyncPolicy : uint8_t
+    {
+        // After every batch
+        Always,
+        // Every SYNC_INTERVAL
+        Periodic,
+        // When the store is closed
+        Never
+    };
+
+    static constexpr std::chrono::seconds SYNC_INTERVAL{5};
+
+    /**
+     * @param name "always", "periodic" or "never"
+     * @throws std::invalid_argument Thrown if the name isn't one of those
+     */
+    static SyncPolicy sync_policy(const std::string& name);
+
+    /**
+     * Opens the store that responses are cached in, has to be called once
+     * before the server starts handling requests.
+     *
+     * @param path The directory of the LMDB environment, created if it doesn't exist
+     * @param budget How many bytes of entries to keep, 0 turns the store off
+     * @param version The version of the dataset, new entries are tagged with it
+     * @throws lmdb::error Thrown if the environment can't be opened
+     */
+    static void initialize(const std::filesystem::path& path, size_t budget, uint64_t version, SyncPolicy sync);
+
+    /**
+     * Writes whatever is still queued and closes the store.
+     */
+    static void shutdown();
+
+    /**
+     * @returns The store, or null if it's turned off
+     */
+    static CacheStore* get();
+
+    CacheStore(const std::filesystem::path& path, size_t budget, uint64_t version, SyncPolicy sync);
+    ~CacheStore();
+
+    CacheStore(const CacheStore&) = delete;
+    CacheStore& operator=(const CacheStore&) = delete;
+
+    [[nodiscard]] std::optional<Hit> find(const std::string& key);
+
+    /**
+     * Queues an entry to be stored, replacing any entry with the same key.
+     *
+     * @param owner Keeps the body alive until it's written
+     * @returns false if the entry is too large or the queue is full
+     */
+    bool insert(const std::string& key, const std::string_view& body, std::shared_ptr<const void> owner);
+
+    /**
+     * Queues the contents of a file to be stored, they're read straight into
+     * the entry. The file is removed once it's written, or right away if it's
+     * rejected.
+     *
+     * @returns false if the entry is too large or the queue is full
+     */
+    bool insert_file(const std::string& key, const std::filesystem::path& file);
+
+    /**
+     * Stops finding an entry right away, it's deleted with the next batch
+     * along with any queued write to it.
+     */
+    void remove(const std::string& key);
+
+    /**
+     * @returns The largest body that insert() will keep
+     */
+    [[nodiscard]] size_t max_entry_size() const noexcept;
+
+private:
+    struct Metadata
+    {
+        size_t size;
+        uint64_t last_used;
+        uint64_t version;
+        bool verified;
+    };
+
+    /**
+     * A queued insert or removal. A body is either in memory or in a file.
+     */
+    struct Write
+    {
+        std::string key;
+        std::string_view body;
+        std::shared_ptr<const void> owner;
+        std::filesystem::path file;
+        size_t size = 0;
+        bool remove = false;
+    };
+
+    void load();
+    bool enqueue(Write write);
+    void run();
+
+    /**
+     * Makes a batch of writes and the evictions they need in one transaction.
+     *
+     * @returns false if nothing could be written
+     */
+    bool write_batch(const std::vector<Write>& batch);
+
+    lmdb::env p_env;
+    MDB_dbi p_dbi;
+    size_t p_budget;
+    uint64_t p_version;
+    SyncPolicy p_sync;
+
+    // Guards everything below, held only briefly by readers
+    std::mutex p_mutex;
+    std::unordered_map<std::string, Metadata> p_entries;
+    size_t p_size = 0;
+    uint64_t p_clock = 0;
+    std::deque<Write> p_queue;
+    size_t p_queued_size = 0;
+    bool p_stopping = false;
+    std::condition_variable p_cv;
+
+    std::thread p_writer;
+};
@@ -0,0 +1,359 @@
+#include "compression.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+#include <zlib.h>
+#ifdef UTOPIA_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "utilities.hpp"
+
+namespace fs = std::filesystem;
+
+namespace compression
+{
+    namespace
+    {
+        int s_level = DEFAULT_LEVEL;
+
+        constexpr Encoding SUPPORTED[] = {
+            Encoding::Gzip,
+#ifdef UTOPIA_WITH_ZSTD
+            Encoding::Zstd,
+#endif
+        };
+
+        // windowBits + 16 makes zlib write a gzip header and trailer instead of a zlib one
+        constexpr int GZIP_WINDOW_BITS = 15 + 16;
+
+        void forget_siblings(CacheStore& store, const std::string& key)
+        {
+            for (auto encoding : SUPPORTED)
+                store.remove(sibling(key, encoding));
+        }
+    }
+
+    void configure(int level)
+    {
+        if (level < 0 || level > 9)
+            throw std::invalid_argument("compression level must be between 0 and 9!");
+        s_level = level;
+    }
+
+    Encoding negotiate(const httpserver::http_request& req)
+    {
+        if (s_level == 0)
+            return Encoding::Identity;
+
+        // A coding that isn't listed gets the q-value of "*", if there is one
+        double gzip = -1, zstd = -1, any = 0;
+
+        std::stringstream ss{util::to_lower(req.get_header("Accept-Encoding"))};
+        for (std::string entry; std::getline(ss, entry, ',');)
+        {
+            auto params = entry.find(';');
+            auto coding = entry.substr(0, params);
+            coding.erase(0, coding.find_first_not_of(" \t"));
+            coding.erase(coding.find_last_not_of(" \t") + 1);
+
+            double q = 1;
+            if (params != std::string::npos)
+            {
+                auto q_pos = entry.find("q=", params);
+                if (q_pos != std::string::npos)
+                    q = std::strtod(entry.c_str() + q_pos + 2, nullptr);
+            }
+
+            if (coding == "gzip" || coding == "x-gzip")
+                gzip = q;
+            else if (coding == "zstd")
+                zstd = q;
+            else if (coding == "*")
+                any = q;
+        }
+
+        if (gzip < 0)
+            gzip = any;
+        if (zstd < 0)
+            zstd = any;
+
+#ifdef UTOPIA_WITH_ZSTD
+        if (zstd > 0 && zstd >= gzip)
+            return Encoding::Zstd;
+#endif
+        if (gzip > 0)
+            return Encoding::Gzip;
+        return Encoding::Identity;
+    }
+
+    const char* name(Encoding encoding)
+    {
+        switch (encoding)
+        {
+            case Encoding::Gzip: return "gzip";
+            case Encoding::Zstd: return "zstd";
+            default: return "identity";
+        }
+    }
+
+    std::optional<Encoding> from_name(const std::string_view& name)
+    {
+        if (name == "identity")
+            return Encoding::Identity;
+        if (s_level == 0)
+            return std::nullopt;
+
+        for (auto encoding : SUPPORTED)
+        {
+            if (name == compression::name(encoding))
+                return encoding;
+        }
+        return std::nullopt;
+    }
+
+    const char* extension(Encoding encoding)
+    {
+        switch (encoding)
+        {
+            case Encoding::Gzip: return ".gz";
+            case Encoding::Zstd: return ".zst";
+            default: return "";
+        }
+    }
+
+    std::string compress(const std::string_view& data, Encoding encoding)
+    {
+        StreamEncoder encoder(encoding);
+        auto out = encoder.update(data);
+        out += encoder.finish();
+        return out;
+    }
+
+    struct StreamEncoder::State
+    {
+        Encoding encoding;
+        z_stream zs{};
+#ifdef UTOPIA_WITH_ZSTD
+        ZSTD_CCtx* cctx = nullptr;
+#endif
+
+        std::string run(const std::string_view& chunk, bool last)
+        {
+            std::string out;
+            char buffer[16 * 1024];
+
+#ifdef UTOPIA_WITH_ZSTD
+            if (encoding == Encoding::Zstd)
+            {
+                ZSTD_inBuffer in { chunk.data(), chunk.size(), 0 };
+                size_t remaining;
+                do
+                {
+                    ZSTD_outBuffer output { buffer, sizeof(buffer), 0 };
+                    remaining = ZSTD_compressStream2(cctx, &output, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+                    if (ZSTD_isError(remaining))
+                        throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+                    out.append(buffer, output.pos);
+                } while (last ? remaining != 0 : in.pos < in.size);
+                return out;
+            }
+#endif
+
+            zs.next_in = (Bytef*)chunk.data();
+            zs.avail_in = (uInt)chunk.size();
+            do
+            {
+                zs.next_out = (Bytef*)buffer;
+                zs.avail_out = sizeof(buffer);
+                if (deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+                    throw std::runtime_error("gzip compression failed");
+                out.append(buffer, sizeof(buffer) - zs.avail_out);
+            } while (zs.avail_out == 0);
+            return out;
+        }
+    };
+
+    StreamEncoder::StreamEncoder(Encoding encoding) : p_state(std::make_unique<State>())
+    {
+        p_state->encoding = encoding;
+
+#ifdef UTOPIA_WITH_ZSTD
+        if (encoding == Encoding::Zstd)
+        {
+            p_state->cctx = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(p_state->cctx, ZSTD_c_compressionLevel, s_level);
+            return;
+        }
+#endif
+
+        if (encoding != Encoding::Gzip)
+            throw std::invalid_argument("Unsupported content encoding");
+        if (deflateInit2(&p_state->zs, s_level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("Failed to initialize gzip compression");
+    }
+
+    StreamEncoder::~StreamEncoder()
+    {
+#ifdef UTOPIA_WITH_ZSTD
+        if (p_state->cctx != nullptr)
+        {
+            ZSTD_freeCCtx(p_state->cctx);
+            return;
+        }
+#endif
+        deflateEnd(&p_state->zs);
+    }
+
+    std::string StreamEncoder::update(const std::string_view& chunk)
+    {
+        return p_state->run(chunk, false);
+    }
+
+    std::string StreamEncoder::finish()
+    {
+        return p_state->run({}, true);
+    }
+
+    std::string sibling(const std::string& key, Encoding encoding)
+    {
+        return key + extension(encoding);
+    }
+
+    bool store(const std::string& key, const body_response& body)
+    {
+        auto* store = CacheStore::get();
+        if (store == nullptr)
+            return false;
+
+        forget_siblings(*store, key);
+        return store->insert(key, body.body(), body.owner());
+    }
+
+    bool store_file(const std::string& key, const fs::path& file)
+    {
+        auto* store = CacheStore::get();
+        if (store == nullptr)
+        {
+            std::error_code ec;
+            fs::remove(file, ec);
+            return false;
+        }
+
+        forget_siblings(*store, key);
+        return store->insert_file(key, file);
+    }
+
+    compressible_response::compressible_response(std::string body, int response_code, const std::string& content_type, std::string store_key)
+        : http_response(response_code, content_type), p_body_response(std::make_shared<body_response>(std::move(body), response_code, content_type)),
+          p_store_key(std::move(store_key)), p_stored(false), p_stale(false), p_code(response_code), p_content_type(content_type)
+    {
+        with_header("Vary", "Accept-Encoding");
+    }
+
+    compressible_response::compressible_response(CacheStore::Hit hit, int response_code, const std::string& content_type, std::string store_key)
+        : http_response(response_code, content_type),
+          p_body_response(std::make_shared<body_response>(hit.body, std::move(hit.snapshot), response_code, content_type)),
+          p_store_key(std::move(store_key)), p_stored(true), p_stale(hit.stale), p_code(response_code), p_content_type(content_type)
+    {
+        p_body_response->set_checksum(hit.checksum);
+        with_header("Vary", "Accept-Encoding");
+    }
+
+    MHD_Response* compressible_response::get_raw_response()
+    {
+        return p_body_response->get_raw_response();
+    }
+
+    size_t compressible_response::size() const
+    {
+        return p_body_response->size();
+    }
+
+    std::shared_ptr<httpserver::http_response> compressible_response::encode(Encoding encoding)
+    {
+        if (encoding == Encoding::Identity)
+            return nullptr;
+
+        auto body = p_body_response->body();
+        if (body.size() < MIN_SIZE)
+            return nullptr;
+
+        auto* store = p_store_key.empty() ? nullptr : CacheStore::get();
+        auto key = sibling(p_store_key, encoding);
+
+        std::shared_ptr<body_response> encoded;
+        // NOTE: Only stored bodies are sent from the store, anything else may
+        //       end up in the result cache and shouldn't hold a read transaction.
+        if (store != nullptr && p_stored)
+        {
+            // Bodies stored before compression was turned on don't have siblings yet
+            if (auto hit = store->find(key))
+            {
+                encoded = std::make_shared<body_response>(hit->body, std::move(hit->snapshot), p_code, p_content_type);
+                encoded->set_checksum(hit->checksum);
+            }
+        }
+
+        if (!encoded)
+        {
+            encoded = std::make_shared<body_response>(compress(body, encoding), p_code, p_content_type);
+            // A stale body's sibling would be stored as if it were current
+            if (store != nullptr && !p_stale)
+                store->insert(key, encoded->body(), encoded->owner());
+        }
+
+        encoded->with_header("Content-Encoding", name(encoding));
+        encoded->with_header("Vary", "Accept-Encoding");
+        return encoded;
+    }
+
+    std::shared_ptr<compressible_response> make_response(std::string body, int code, const std::string& content_type, std::string store_key)
+    {
+        auto response = std::make_shared<compressible_response>(std::move(body), code, content_type, std::move(store_key));
+        if (!response->store_key().empty())
+            store(response->store_key(), *response->body());
+        return response;
+    }
+
+    std::shared_ptr<compressible_response> make_stored_response(const std::string& key, int code, const std::string& content_type)
+    {
+        auto* store = CacheStore::get();
+        if (store == nullptr)
+            return nullptr;
+
+        auto hit = store->find(key);
+        if (!hit)
+            return nullptr;
+        return std::make_shared<compressible_response>(std::move(*hit), code, content_type, key);
+    }
+
+    std::shared_ptr<httpserver::http_response> encode(Encoding encoding, const std::shared_ptr<httpserver::http_response>& res)
+    {
+        auto compressible = std::dynamic_pointer_cast<compressible_response>(res);
+        if (!compressible)
+            return res;
+
+        try
+        {
+            if (auto encoded = compressible->encode(encoding))
+                return encoded;
+        }
+        catch (std::exception& ex)
+        {
+            spdlog::error("Failed to compress a response, sending it as is: {}", ex.what());
+        }
+        return res;
+    }
+
+    std::shared_ptr<httpserver::http_response> encode(const httpserver::http_request& req, const std::shared_ptr<httpserver::http_response>& res)
+    {
+        // Only compressible responses care about the request's encodings
+        if (!std::dynamic_pointer_cast<compressible_response>(res))
+            return res;
+        return encode(negotiate(req), res);
+    }
+}
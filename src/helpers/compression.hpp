@@ -0,0 +1,173 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <optional>
+#include <filesystem>
+
+#include <httpserver.hpp>
+
+#include "body_response.hpp"
+#include "cache_store.hpp"
+
+/**
+ * Content-Encoding support for responses.
+ *
+ * Documents that are worth compressing are returned as a compressible_response,
+ * and encode() (called for every response by the resource macros) swaps them
+ * for an encoded response when the client accepts one. Bodies kept in the
+ * cache store get encoded siblings stored next to them (x.xml.gz, x.xml.zst),
+ * so cache hits don't have to compress anything.
+ *
+ * zstd is only available when built with UTOPIA_WITH_ZSTD.
+ */
+namespace compression
+{
+    enum class Encoding : uint8_t
+    {
+        Identity,
+        Gzip,
+        Zstd
+    };
+
+    constexpr int DEFAULT_LEVEL = 6;
+    // Smaller bodies barely shrink, so they're sent as is
+    constexpr size_t MIN_SIZE = 1024;
+
+    /**
+     * Sets the compression level, 0 turns compression off. zstd uses the same
+     * level as gzip, which at 1 through 9 is roughly as fast.
+     *
+     * @throws std::invalid_argument Thrown if the level isn't between 0 and 9
+     */
+    void configure(int level);
+
+    /**
+     * Picks the encoding to respond with from the Accept-Encoding header,
+     * the one with the highest q-value wins and zstd wins ties.
+     */
+    Encoding negotiate(const httpserver::http_request& req);
+
+    const char* name(Encoding encoding);
+
+    /**
+     * @returns The encoding called `name`, or nothing if responses are never
+     *          sent with it (it's unknown, not built in or compression is off)
+     */
+    std::optional<Encoding> from_name(const std::string_view& name);
+    const char* extension(Encoding encoding);
+
+    std::string compress(const std::string_view& data, Encoding encoding);
+
+    /**
+     * Compresses a body that's produced a chunk at a time.
+     */
+    class StreamEncoder
+    {
+    public:
+        explicit StreamEncoder(Encoding encoding);
+        ~StreamEncoder();
+
+        StreamEncoder(const StreamEncoder&) = delete;
+        StreamEncoder& operator=(const StreamEncoder&) = delete;
+
+        /**
+         * @returns Whatever compressed output is ready, which may be nothing
+         */
+        std::string update(const std::string_view& chunk);
+
+        /**
+         * @returns The rest of the compressed output
+         */
+        std::string finish();
+
+    private:
+        struct State;
+        std::unique_ptr<State> p_state;
+    };
+
+    /**
+     * @returns The key the `encoding` version of a stored body is kept under
+     */
+    std::string sibling(const std::string& key, Encoding encoding);
+
+    /**
+     * Queues a body to be stored in the cache store and drops its encoded
+     * siblings, which were encoded from whatever was stored under the key before.
+     */
+    bool store(const std::string& key, const body_response& body);
+
+    /**
+     * Same as store(), with the body read from a file that's removed once
+     * it's stored.
+     */
+    bool store_file(const std::string& key, const std::filesystem::path& file);
+
+    /**
+     * A response that's sent compressed if the client accepts it, the body is
+     * either in memory or read from the cache store.
+     */
+    class compressible_response : public httpserver::http_response
+    {
+    public:
+        compressible_response(std::string body, int response_code, const std::string& content_type, std::string store_key);
+        compressible_response(CacheStore::Hit hit, int response_code, const std::string& content_type, std::string store_key);
+
+        MHD_Response* get_raw_response() override;
+
+        /**
+         * @returns The size of the response before it's encoded
+         */
+        [[nodiscard]] size_t size() const;
+
+        /**
+         * @returns The response encoded with `encoding`, or null if it should be sent as is
+         */
+        std::shared_ptr<httpserver::http_response> encode(Encoding encoding);
+
+        [[nodiscard]] inline const std::shared_ptr<body_response>& body() const noexcept { return p_body_response; }
+
+        /**
+         * @returns Whether the body was read from the cache store
+         */
+        [[nodiscard]] inline bool stored() const noexcept { return p_stored; }
+
+        /**
+         * @returns Whether the body was read from the cache store but computed
+         *          from another version of the dataset
+         */
+        [[nodiscard]] inline bool stale() const noexcept { return p_stale; }
+
+        [[nodiscard]] inline const std::string& store_key() const noexcept { return p_store_key; }
+
+    private:
+        std::shared_ptr<body_response> p_body_response;
+        // Where the body is stored, so its encoded siblings can be stored too
+        std::string p_store_key;
+        bool p_stored;
+        bool p_stale;
+        int p_code;
+        std::string p_content_type;
+    };
+
+    /**
+     * @param store_key Where to store the body, or empty to not store it
+     */
+    std::shared_ptr<compressible_response> make_response(std::string body, int code, const std::string& content_type, std::string store_key = {});
+
+    /**
+     * @returns The body stored under `key`, or null if there isn't one
+     */
+    std::shared_ptr<compressible_response> make_stored_response(const std::string& key, int code, const std::string& content_type);
+
+    /**
+     * Encodes the response if it's compressible, sending it as is if that fails.
+     */
+    std::shared_ptr<httpserver::http_response> encode(Encoding encoding, const std::shared_ptr<httpserver::http_response>& res);
+
+    /**
+     * Encodes the response for the request if it's compressible.
+     */
+    std::shared_ptr<httpserver::http_response> encode(const httpserver::http_request& req, const std::shared_ptr<httpserver::http_response>& res);
+}
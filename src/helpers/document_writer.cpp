@@ -0,0 +1,65 @@
+#include "document_writer.hpp"
+
+#include "xml_writer.hpp"
+#include "json_writer.hpp"
+
+#include <stdexcept>
+
+std::unique_ptr<DocumentWriter> DocumentWriter::create(OutputFormat format, bool pretty, sink output, size_t flush_threshold)
+{
+    switch (format)
+    {
+        case OutputFormat::Json:
+            return std::make_unique<JsonWriter>(pretty, std::move(output), flush_threshold);
+        case OutputFormat::Xml:
+            return std::make_unique<XmlWriter>(pretty, std::move(output), flush_threshold);
+        default:
+            throw std::invalid_argument("Not a document format");
+    }
+}
+
+const char* DocumentWriter::content_type(OutputFormat format)
+{
+    switch (format)
+    {
+        case OutputFormat::Json: return "application/json";
+        case OutputFormat::Arrow: return "application/vnd.apache.arrow.stream";
+        default: return "application/xml";
+    }
+}
+
+const char* DocumentWriter::extension(OutputFormat format)
+{
+    switch (format)
+    {
+        case OutputFormat::Json: return ".json";
+        case OutputFormat::Arrow: return ".arrow";
+        default: return ".xml";
+    }
+}
+
+DocumentWriter::DocumentWriter(sink output, size_t flush_threshold)
+    : p_sink(std::move(output)), p_flush_threshold(flush_threshold)
+{
+    p_buffer.reserve(p_sink ? flush_threshold + flush_threshold / 4 : flush_threshold);
+}
+
+std::string DocumentWriter::serialize()
+{
+    if (p_sink)
+        throw std::logic_error("serialize() can't be used with a sink");
+
+    finish();
+    return std::move(p_buffer);
+}
+
+void DocumentWriter::flush(bool force)
+{
+    if (!p_sink || p_buffer.empty() || (!force && p_buffer.size() < p_flush_threshold))
+        return;
+
+    on_flush(p_buffer);
+    p_sink(p_buffer);
+    p_buffer.clear();
+    p_flushed = true;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+
+enum class OutputFormat : uint8_t
+{
+    Xml,
+    Json,
+    // Not a document format, only tabular results can be written as Arrow (see ArrowWriter)
+    Arrow
+};
+
+/**
+ * The interface shared by the streaming writers, so a response can be built
+ * once and serialized in whichever format the client asked for.
+ *
+ * Writers append to an output buffer, and when a sink is given they hand the
+ * buffer to it whenever it grows past the flush threshold.
+ */
+class DocumentWriter
+{
+public:
+    using attribute_map = std::unordered_map<std::string, std::string>;
+    using sink = std::function<void(const std::string_view&)>;
+
+    static constexpr size_t DEFAULT_FLUSH_THRESHOLD = 64 * 1024;
+
+    DocumentWriter(const DocumentWriter&) = delete;
+    DocumentWriter& operator=(const DocumentWriter&) = delete;
+    virtual ~DocumentWriter() = default;
+
+    /**
+     * Creates a writer for the given format.
+     *
+     * @param format The format of the document
+     * @param pretty Whether or not to indent the document
+     * @param output Where to send the document as it's written, if null the
+     *               whole document is kept in memory until serialize()
+     * @param flush_threshold How many bytes to buffer before calling `output`
+     * @throws std::invalid_argument Thrown if the format isn't a document format
+     */
+    static std::unique_ptr<DocumentWriter> create(OutputFormat format, bool pretty, sink output = nullptr, size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD);
+
+    static const char* content_type(OutputFormat format);
+    static const char* extension(OutputFormat format);
+
+    [[nodiscard]] virtual OutputFormat format() const noexcept = 0;
+
+    virtual DocumentWriter& add_string(const std::string_view& name, const attribute_map& attributes, const std::string_view& data) = 0;
+    virtual DocumentWriter& add_child(const std::string_view& name, const attribute_map& attributes) = 0;
+    virtual DocumentWriter& add_empty(const std::string_view& name, const attribute_map& attributes) = 0;
+
+    /**
+     * Starts an element whose children are all of the same kind, step_up()
+     * ends it. This only makes a difference to formats that have arrays.
+     */
+    virtual DocumentWriter& begin_array(const std::string_view& name, const attribute_map& attributes) = 0;
+
+    virtual DocumentWriter& add_signature() = 0;
+    virtual DocumentWriter& step_up() = 0;
+
+    /**
+     * Closes everything that's still open and flushes whatever is left.
+     */
+    virtual void finish() = 0;
+
+    /**
+     * Finishes the document and returns it, only valid if there's no sink.
+     */
+    std::string serialize();
+
+    inline DocumentWriter& add_string(const std::string_view& name, const std::string_view& data)
+    {
+        return add_string(name, attribute_map{}, data);
+    }
+
+    inline DocumentWriter& add_child(const std::string_view& name)
+    {
+        return add_child(name, attribute_map{});
+    }
+
+    inline DocumentWriter& add_empty(const std::string_view& name)
+    {
+        return add_empty(name, attribute_map{});
+    }
+
+    inline DocumentWriter& begin_array(const std::string_view& name)
+    {
+        return begin_array(name, attribute_map{});
+    }
+
+    template<typename T, typename Func>
+    inline DocumentWriter& add_array(const std::string_view& name, const attribute_map& attributes, const std::vector<T>& elems, Func for_each)
+    {
+        begin_array(name, attributes);
+        for (const auto& elem : elems)
+            for_each(*this, elem);
+        return step_up();
+    }
+
+    template<typename T, typename Func>
+    inline DocumentWriter& add_array(const std::string_view& name, const std::vector<T>& elems, Func for_each)
+    {
+        return add_array(name, attribute_map{}, elems, for_each);
+    }
+
+    template<typename T, typename Func>
+    inline DocumentWriter& add_array(const std::string_view& name, const std::initializer_list<T>& elems, Func for_each)
+    {
+        return add_array(name, std::vector<T>{elems}, for_each);
+    }
+
+    template<typename T, typename Func>
+    inline DocumentWriter& add_array(const std::string_view& name, const attribute_map& attributes, const std::initializer_list<T>& elems, Func for_each)
+    {
+        return add_array(name, attributes, std::vector<T>{elems}, for_each);
+    }
+
+    template<typename InputIterator, typename Func>
+    inline DocumentWriter& add_iterator(const std::string_view& name, const attribute_map& attributes, InputIterator begin, InputIterator end, Func for_each)
+    {
+        begin_array(name, attributes);
+        for (; begin != end; ++begin)
+            for_each(*this, *begin);
+        return step_up();
+    }
+
+    template<typename InputIterator, typename Func>
+    inline DocumentWriter& add_iterator(const std::string_view& name, InputIterator begin, InputIterator end, Func for_each)
+    {
+        return add_iterator(name, attribute_map{}, begin, end, for_each);
+    }
+
+protected:
+    DocumentWriter(sink output, size_t flush_threshold);
+
+    /**
+     * Hands the buffer to the sink once it's past the flush threshold, or
+     * right away if `force` is set.
+     */
+    void flush(bool force);
+
+    /**
+     * Called with every chunk right before it's handed to the sink.
+     */
+    virtual void on_flush(const std::string_view&) {}
+
+    std::string p_buffer;
+    sink p_sink;
+    size_t p_flush_threshold;
+    bool p_flushed = false;
+};
@@ -0,0 +1,183 @@
+#include "formatting.hpp"
+
+#include <vector>
+#include <algorithm>
+
+namespace formatting
+{
+    namespace
+    {
+        constexpr time_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+        /**
+         * Every change of the local UTC offset between FIRST and LAST,
+         * so converting a time to local time is a binary search instead
+         * of a call to localtime.
+         */
+        struct TimezoneTable
+        {
+            // 1970-01-01 and 2100-01-01, times outside of that fall back to localtime_r
+            static constexpr time_t FIRST = 0;
+            static constexpr time_t LAST = 4102444800;
+
+            struct Transition
+            {
+                time_t start;
+                long offset;
+            };
+
+            std::vector<Transition> transitions;
+
+            static long offset_at(time_t time)
+            {
+                std::tm tm{};
+                localtime_r(&time, &tm);
+                return tm.tm_gmtoff;
+            }
+
+            TimezoneTable()
+            {
+                tzset();
+                transitions.push_back({ FIRST, offset_at(FIRST) });
+
+                // NOTE: Offsets don't change more than once a day anywhere, so
+                //       checking daily and narrowing down finds every change.
+                for (time_t day = FIRST; day < LAST; day += SECONDS_PER_DAY)
+                {
+                    auto next = day + SECONDS_PER_DAY;
+                    if (offset_at(next) == transitions.back().offset)
+                        continue;
+
+                    time_t low = day, high = next;
+                    while (high - low > 1)
+                    {
+                        auto mid = low + (high - low) / 2;
+                        if (offset_at(mid) == transitions.back().offset)
+                            low = mid;
+                        else
+                            high = mid;
+                    }
+                    transitions.push_back({ high, offset_at(high) });
+                }
+            }
+
+            [[nodiscard]] bool covers(time_t time) const
+            {
+                return time >= FIRST && time < LAST;
+            }
+
+            [[nodiscard]] long offset(time_t time) const
+            {
+                auto it = std::upper_bound(transitions.begin(), transitions.end(), time,
+                                           [](time_t t, const Transition& transition) { return t < transition.start; });
+                return std::prev(it)->offset;
+            }
+        };
+
+        const TimezoneTable& timezone_table()
+        {
+            static const TimezoneTable table;
+            return table;
+        }
+
+        inline char* two_digits(char* out, int value)
+        {
+            out[0] = (char)('0' + value / 10);
+            out[1] = (char)('0' + value % 10);
+            return out + 2;
+        }
+
+        /**
+         * Converts days since the epoch to a year, month and day, from
+         * Howard Hinnant's civil_from_days.
+         */
+        void civil_from_days(long days, long& year, int& month, int& day)
+        {
+            days += 719468;
+            long era = (days >= 0 ? days : days - 146096) / 146097;
+            long doe = days - era * 146097;
+            long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+            long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+            long mp = (5 * doy + 2) / 153;
+
+            day = (int)(doy - (153 * mp + 2) / 5 + 1);
+            month = (int)(mp < 10 ? mp + 3 : mp - 9);
+            year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+        }
+    }
+
+    std::string_view amount(buffer& buf, long cents)
+    {
+        long dollars = cents / 100;
+        long remainder = cents < 0 ? -(cents % 100) : cents % 100;
+
+        char* out = buf.data();
+        *out++ = '$';
+        out = std::to_chars(out, buf.data() + buf.size(), dollars).ptr;
+        *out++ = '.';
+        out = two_digits(out, (int)remainder);
+        return { buf.data(), (size_t)(out - buf.data()) };
+    }
+
+    std::string_view date(buffer& buf, time_t time)
+    {
+        const auto& table = timezone_table();
+
+        long year;
+        int month, day, hour, minute, second;
+        if (table.covers(time))
+        {
+            auto local = time + table.offset(time);
+            auto days = local / SECONDS_PER_DAY;
+            auto seconds = local % SECONDS_PER_DAY;
+            if (seconds < 0)
+            {
+                seconds += SECONDS_PER_DAY;
+                --days;
+            }
+
+            civil_from_days(days, year, month, day);
+            hour = (int)(seconds / 3600);
+            minute = (int)(seconds / 60 % 60);
+            second = (int)(seconds % 60);
+        }
+        else
+        {
+            std::tm tm{};
+            localtime_r(&time, &tm);
+            year = tm.tm_year + 1900;
+            month = tm.tm_mon + 1;
+            day = tm.tm_mday;
+            hour = tm.tm_hour;
+            minute = tm.tm_min;
+            second = tm.tm_sec;
+        }
+
+        char* out = buf.data();
+        out = two_digits(out, hour);
+        *out++ = ':';
+        out = two_digits(out, minute);
+        *out++ = ':';
+        out = two_digits(out, second);
+        *out++ = ' ';
+        out = two_digits(out, month);
+        *out++ = '/';
+        out = two_digits(out, day);
+        *out++ = '/';
+        out = std::to_chars(out, buf.data() + buf.size(), year).ptr;
+        return { buf.data(), (size_t)(out - buf.data()) };
+    }
+
+    std::string_view expiration(buffer& buf, int month, int year)
+    {
+        char* out = std::to_chars(buf.data(), buf.data() + buf.size(), month).ptr;
+        *out++ = '/';
+        out = std::to_chars(out, buf.data() + buf.size(), year).ptr;
+        return { buf.data(), (size_t)(out - buf.data()) };
+    }
+
+    void initialize()
+    {
+        timezone_table();
+    }
+}
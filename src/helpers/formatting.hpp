@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string_view>
+#include <array>
+#include <charconv>
+#include <ctime>
+
+/**
+ * Formats the scalars that end up in responses into a buffer owned by the
+ * caller, without allocating, locking or going through a locale.
+ *
+ * The returned views point into the buffer, so they're only valid as long as
+ * it is and until it's reused.
+ */
+namespace formatting
+{
+    // Large enough for any value formatted below
+    using buffer = std::array<char, 32>;
+
+    template<typename T>
+    inline std::string_view integer(buffer& buf, T value)
+    {
+        auto [end, ec] = std::to_chars(buf.data(), buf.data() + buf.size(), value);
+        return { buf.data(), (size_t)(end - buf.data()) };
+    }
+
+    /**
+     * Formats cents as dollars, e.g. 12345 as "$123.45".
+     */
+    std::string_view amount(buffer& buf, long cents);
+
+    /**
+     * Formats a time in the server's local timezone as "HH:MM:SS MM/DD/YYYY",
+     * the same as strftime's "%T %m/%d/%Y".
+     */
+    std::string_view date(buffer& buf, time_t time);
+
+    /**
+     * Formats a card expiration date as "M/YYYY".
+     */
+    std::string_view expiration(buffer& buf, int month, int year);
+
+    /**
+     * Builds the timezone offset table date() uses, otherwise it's built by
+     * the first call to date().
+     */
+    void initialize();
+}
@@ -0,0 +1,178 @@
+#include "json_writer.hpp"
+
+#include <algorithm>
+
+JsonWriter::JsonWriter(bool pretty, sink output, size_t flush_threshold)
+    : DocumentWriter(std::move(output), flush_threshold), p_pretty(pretty)
+{
+    p_buffer.push_back('{');
+    p_scopes.push_back(Scope::Object);
+}
+
+DocumentWriter& JsonWriter::add_string(const std::string_view& name, const attribute_map& attributes, const std::string_view& data)
+{
+    if (attributes.empty())
+    {
+        begin_value(name);
+        write_string(data);
+        flush(false);
+        return *this;
+    }
+
+    add_child(name, attributes);
+    begin_value("value");
+    write_string(data);
+    return step_up();
+}
+
+DocumentWriter& JsonWriter::add_child(const std::string_view& name, const attribute_map& attributes)
+{
+    begin_value(name);
+    p_buffer.push_back('{');
+    p_scopes.push_back(Scope::Object);
+    p_first = true;
+    write_attributes(attributes);
+    return *this;
+}
+
+DocumentWriter& JsonWriter::add_empty(const std::string_view& name, const attribute_map& attributes)
+{
+    add_child(name, attributes);
+    return step_up();
+}
+
+DocumentWriter& JsonWriter::begin_array(const std::string_view& name, const attribute_map& attributes)
+{
+    if (p_scopes.back() == Scope::Object)
+    {
+        write_attributes(attributes);
+        begin_value(name);
+        p_buffer.push_back('[');
+        p_scopes.push_back(Scope::Array);
+    }
+    else
+    {
+        add_child(name, attributes);
+        begin_value(name);
+        p_buffer.push_back('[');
+        p_scopes.push_back(Scope::WrappedArray);
+    }
+
+    p_first = true;
+    return *this;
+}
+
+DocumentWriter& JsonWriter::add_signature()
+{
+    return *this;
+}
+
+DocumentWriter& JsonWriter::step_up()
+{
+    // The top level object is only ever closed by finish()
+    if (p_scopes.size() <= 1)
+        return *this;
+
+    auto scope = p_scopes.back();
+    p_scopes.pop_back();
+
+    if (!p_first)
+        indent();
+    p_buffer.push_back(scope == Scope::Object ? '}' : ']');
+
+    if (scope == Scope::WrappedArray)
+    {
+        p_scopes.pop_back();
+        indent();
+        p_buffer.push_back('}');
+    }
+
+    p_first = false;
+    flush(false);
+    return *this;
+}
+
+void JsonWriter::finish()
+{
+    if (p_finished)
+        return;
+
+    while (p_scopes.size() > 1)
+        step_up();
+
+    p_scopes.clear();
+    if (!p_first)
+        indent();
+    p_buffer.append("}\n");
+
+    p_finished = true;
+    flush(true);
+}
+
+void JsonWriter::begin_value(const std::string_view& name)
+{
+    if (!p_first)
+        p_buffer.push_back(',');
+    p_first = false;
+
+    indent();
+    if (p_scopes.back() == Scope::Object)
+    {
+        write_string(name);
+        p_buffer.append(p_pretty ? ": " : ":");
+    }
+}
+
+void JsonWriter::write_string(const std::string_view& str)
+{
+    constexpr const char* HEX = "0123456789abcdef";
+
+    p_buffer.push_back('"');
+
+    auto needs_escape = [](char c) { return c == '"' || c == '\\' || (unsigned char)c < 0x20; };
+    auto start = str.begin();
+    while (start != str.end())
+    {
+        auto pos = std::find_if(start, str.end(), needs_escape);
+        p_buffer.append(start, pos);
+        if (pos == str.end())
+            break;
+
+        switch (*pos)
+        {
+            case '"': p_buffer.append("\\\""); break;
+            case '\\': p_buffer.append("\\\\"); break;
+            case '\n': p_buffer.append("\\n"); break;
+            case '\r': p_buffer.append("\\r"); break;
+            case '\t': p_buffer.append("\\t"); break;
+            case '\b': p_buffer.append("\\b"); break;
+            case '\f': p_buffer.append("\\f"); break;
+            default:
+                p_buffer.append("\\u00");
+                p_buffer.push_back(HEX[((unsigned char)*pos >> 4) & 0xF]);
+                p_buffer.push_back(HEX[(unsigned char)*pos & 0xF]);
+                break;
+        }
+        start = pos + 1;
+    }
+
+    p_buffer.push_back('"');
+}
+
+void JsonWriter::write_attributes(const attribute_map& attributes)
+{
+    for (const auto& [attribute, value] : attributes)
+    {
+        begin_value(attribute);
+        write_string(value);
+    }
+}
+
+void JsonWriter::indent()
+{
+    if (p_pretty)
+    {
+        p_buffer.push_back('\n');
+        p_buffer.append(p_scopes.size() * 2, ' ');
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include "document_writer.hpp"
+
+/**
+ * Writes the same documents as XmlWriter as JSON, without going through a
+ * DOM or libxml2.
+ *
+ * The envelope becomes the top level object and the rest maps as follows:
+ *   - add_child() adds an object member, its attributes become string members
+ *   - add_string() adds a string member, or an object with the attributes and
+ *     a "value" member if there are any attributes
+ *   - begin_array(), add_array() and add_iterator() add an array member, and
+ *     their attributes are added to the enclosing object instead
+ *   - elements inside of an array lose their names
+ *
+ * JSON documents aren't signed, add_signature() is accepted but ignored.
+ */
+class JsonWriter : public DocumentWriter
+{
+public:
+    explicit JsonWriter(bool pretty = false, sink output = nullptr, size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD);
+
+    using DocumentWriter::add_string;
+    using DocumentWriter::add_child;
+    using DocumentWriter::add_empty;
+    using DocumentWriter::begin_array;
+
+    [[nodiscard]] OutputFormat format() const noexcept override { return OutputFormat::Json; }
+
+    DocumentWriter& add_string(const std::string_view& name, const attribute_map& attributes, const std::string_view& data) override;
+    DocumentWriter& add_child(const std::string_view& name, const attribute_map& attributes) override;
+    DocumentWriter& add_empty(const std::string_view& name, const attribute_map& attributes) override;
+    DocumentWriter& begin_array(const std::string_view& name, const attribute_map& attributes) override;
+
+    DocumentWriter& add_signature() override;
+    DocumentWriter& step_up() override;
+
+    void finish() override;
+
+private:
+    enum class Scope : uint8_t
+    {
+        Object,
+        Array,
+        // An array inside of an array, wrapped in an object to hold its attributes
+        WrappedArray
+    };
+
+    void begin_value(const std::string_view& name);
+    void write_string(const std::string_view& str);
+    void write_attributes(const attribute_map& attributes);
+    void indent();
+
+    bool p_pretty;
+    bool p_finished = false;
+    bool p_first = true;
+    std::vector<Scope> p_scopes;
+};
@@ -0,0 +1,83 @@
+#include "perfect_hash.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+// Average number of keys per bucket, larger values make the displacement
+// table smaller but the build slower.
+constexpr size_t KEYS_PER_BUCKET = 4;
+constexpr uint32_t MAX_DISPLACEMENT = 1u << 24;
+constexpr int MAX_SEEDS = 8;
+
+PerfectHash::PerfectHash(const std::vector<uint64_t>& keys) : p_size(keys.size())
+{
+    if (keys.empty())
+        return;
+
+    size_t bucket_count = std::max<size_t>(1, keys.size() / KEYS_PER_BUCKET);
+
+    for (int attempt = 0; attempt < MAX_SEEDS; ++attempt)
+    {
+        p_seed = mix((uint64_t)attempt + 1);
+        p_displacements.assign(bucket_count, 0);
+
+        std::vector<std::vector<uint64_t>> buckets(bucket_count);
+        for (auto key : keys)
+            buckets[mix(key ^ p_seed) % bucket_count].push_back(key);
+
+        // Placing the biggest buckets first while the table is still mostly
+        // empty is what keeps the search for displacements short.
+        std::vector<size_t> order(bucket_count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::vector<bool> taken(p_size, false);
+        std::vector<size_t> slots;
+        bool failed = false;
+
+        for (auto bucket : order)
+        {
+            const auto& bucket_keys = buckets[bucket];
+            if (bucket_keys.empty())
+                break;
+
+            uint32_t displacement = 0;
+            for (; displacement < MAX_DISPLACEMENT; ++displacement)
+            {
+                slots.clear();
+                bool fits = true;
+                for (auto key : bucket_keys)
+                {
+                    auto s = slot(key, displacement);
+                    if (taken[s] || std::find(slots.begin(), slots.end(), s) != slots.end())
+                    {
+                        fits = false;
+                        break;
+                    }
+                    slots.push_back(s);
+                }
+
+                if (fits)
+                    break;
+            }
+
+            if (displacement == MAX_DISPLACEMENT)
+            {
+                failed = true;
+                break;
+            }
+
+            p_displacements[bucket] = displacement;
+            for (auto s : slots)
+                taken[s] = true;
+        }
+
+        if (!failed)
+            return;
+    }
+
+    throw std::runtime_error("Unable to build a perfect hash, are the keys unique?");
+}
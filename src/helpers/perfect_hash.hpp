@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * A minimal perfect hash over a fixed set of 64-bit keys, built with the
+ * "hash and displace" scheme. Every key in the set maps to a unique index
+ * in [0, size()), so the index can address a dense array directly.
+ *
+ * Keys that were not in the original set still map to *some* index, so
+ * callers have to compare the stored key to confirm a hit.
+ */
+class PerfectHash
+{
+    std::vector<uint32_t> p_displacements;
+    uint64_t p_seed = 0;
+    size_t p_size = 0;
+
+public:
+    PerfectHash() = default;
+
+    /**
+     * Builds the hash for the given set of keys.
+     *
+     * @param keys A list of unique keys
+     * @throws std::runtime_error Thrown if no displacement could be found, which
+     *                            in practice only happens with duplicate keys
+     */
+    explicit PerfectHash(const std::vector<uint64_t>& keys);
+
+    [[nodiscard]] inline size_t size() const noexcept { return p_size; }
+
+    [[nodiscard]] inline size_t operator()(uint64_t key) const noexcept
+    {
+        if (p_size == 0)
+            return 0;
+
+        auto bucket = mix(key ^ p_seed) % p_displacements.size();
+        return slot(key, p_displacements[bucket]);
+    }
+
+private:
+    [[nodiscard]] static inline uint64_t mix(uint64_t x) noexcept
+    {
+        // splitmix64 finalizer
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    [[nodiscard]] inline size_t slot(uint64_t key, uint32_t displacement) const noexcept
+    {
+        return mix(key + p_seed + (displacement + 1) * 0x9E3779B97F4A7C15ull) % p_size;
+    }
+};
@@ -0,0 +1,94 @@
+#include "result_cache.hpp"
+
+#include "body_response.hpp"
+
+namespace
+{
+    // No single entry may take more than 1/ENTRY_FRACTION of the budget
+    constexpr size_t ENTRY_FRACTION = 8;
+}
+
+std::shared_ptr<httpserver::http_response> ResultCache::Entry::response() const
+{
+    auto res = std::make_shared<body_response>(body, owner, 200, content_type);
+    if (encoding != compression::Encoding::Identity)
+        res->with_header("Content-Encoding", compression::name(encoding));
+    res->with_header("Vary", "Accept-Encoding");
+    if (!etag.empty())
+    {
+        res->with_header("ETag", etag);
+        res->with_header("Accept-Ranges", "bytes");
+    }
+    return res;
+}
+
+ResultCache::ResultCache(size_t budget) : p_budget(budget)
+{
+}
+
+void ResultCache::set_budget(size_t budget)
+{
+    std::lock_guard lock(p_mutex);
+    p_budget = budget;
+    evict();
+}
+
+std::optional<ResultCache::Entry> ResultCache::find(const std::string& key)
+{
+    std::lock_guard lock(p_mutex);
+    auto it = p_index.find(key);
+    if (it == p_index.end())
+        return std::nullopt;
+
+    p_entries.splice(p_entries.begin(), p_entries, it->second);
+    return it->second->second;
+}
+
+bool ResultCache::insert(const std::string& key, Entry entry)
+{
+    if (!entry.owner)
+        return false;
+
+    std::lock_guard lock(p_mutex);
+    if (entry.body.size() > p_budget / ENTRY_FRACTION)
+        return false;
+
+    auto it = p_index.find(key);
+    if (it != p_index.end())
+    {
+        p_size -= it->second->second.body.size();
+        p_entries.erase(it->second);
+        p_index.erase(it);
+    }
+
+    p_size += entry.body.size();
+    p_entries.emplace_front(key, std::move(entry));
+    p_index.emplace(key, p_entries.begin());
+    evict();
+    return true;
+}
+
+size_t ResultCache::max_entry_size() const
+{
+    std::lock_guard lock(p_mutex);
+    return p_budget / ENTRY_FRACTION;
+}
+
+void ResultCache::clear()
+{
+    std::lock_guard lock(p_mutex);
+    p_entries.clear();
+    p_index.clear();
+    p_size = 0;
+}
+
+void ResultCache::evict()
+{
+    while (p_size > p_budget && !p_entries.empty())
+    {
+        const auto& [key, entry] = p_entries.back();
+        p_size -= entry.body.size();
+        p_index.erase(key);
+        p_entries.pop_back();
+    }
+}
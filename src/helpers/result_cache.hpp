@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <optional>
+
+#include <httpserver.hpp>
+
+#include "compression.hpp"
+
+/**
+ * Finished response bodies kept in memory, so a query that's asked for again
+ * is answered without running it. The least recently used bodies are evicted
+ * once they add up to more than the budget.
+ *
+ * Keys have to contain everything that changes the body, including the
+ * dataset it was computed from.
+ */
+class ResultCache
+{
+public:
+    struct Entry
+    {
+        std::string_view body;
+        // Keeps the body alive
+        std::shared_ptr<const void> owner;
+        std::string content_type;
+        compression::Encoding encoding = compression::Encoding::Identity;
+        // The entity tag of the body, responses are only tagged if it's set
+        std::string etag;
+
+        /**
+         * @returns A response sending the body without copying it
+         */
+        [[nodiscard]] std::shared_ptr<httpserver::http_response> response() const;
+    };
+
+    /**
+     * @param budget How many bytes of bodies to keep, 0 turns the cache off
+     */
+    explicit ResultCache(size_t budget);
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    /**
+     * Changes the budget, evicting entries if it shrank.
+     */
+    void set_budget(size_t budget);
+
+    [[nodiscard]] std::optional<Entry> find(const std::string& key);
+
+    /**
+     * Adds an entry, replacing any entry with the same key. Bodies larger than
+     * a fraction of the budget aren't kept, so one big result can't push
+     * everything else out.
+     *
+     * @returns Whether the entry was kept
+     */
+    bool insert(const std::string& key, Entry entry);
+
+    /**
+     * @returns The largest body that insert() would keep
+     */
+    [[nodiscard]] size_t max_entry_size() const;
+
+    void clear();
+
+private:
+    using node = std::pair<std::string, Entry>;
+
+    void evict();
+
+    mutable std::mutex p_mutex;
+    // Most recently used first
+    std::list<node> p_entries;
+    std::unordered_map<std::string, std::list<node>::iterator> p_index;
+    size_t p_budget;
+    size_t p_size = 0;
+};
@@ -0,0 +1,192 @@
+#include "signer.hpp"
+
+#include "utilities.hpp"
+
+#include <openssl/aes.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/bio.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/objects.h>
+#include <openssl/dsa.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+#include <memory>
+#include <stdexcept>
+
+bool DocumentSigner::s_can_sign = false;
+EVP_PKEY* DocumentSigner::s_private_key = nullptr;
+SignatureAlgorithm DocumentSigner::s_algorithm = SignatureAlgorithm::DsaSha1;
+size_t DocumentSigner::s_component_size = 0;
+std::string DocumentSigner::s_certificate = std::string();
+std::string DocumentSigner::s_encoded_certificate = std::string();
+
+namespace
+{
+    /**
+     * @returns The NID of an EC key's curve, or NID_undef if it isn't an EC key
+     */
+    int curve_of(EVP_PKEY* key)
+    {
+        if (EVP_PKEY_id(key) != EVP_PKEY_EC)
+            return NID_undef;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        char name[64];
+        if (EVP_PKEY_get_group_name(key, name, sizeof(name), nullptr) != 1)
+            return NID_undef;
+        return OBJ_sn2nid(name);
+#else
+        const EC_KEY* ec = EVP_PKEY_get0_EC_KEY(key);
+        const EC_GROUP* group = ec == nullptr ? nullptr : EC_KEY_get0_group(ec);
+        return group == nullptr ? NID_undef : EC_GROUP_get_curve_name(group);
+#endif
+    }
+
+    /**
+     * @returns The size in bytes of a DSA key's subprime, which is how large r and s get
+     */
+    size_t subprime_size(EVP_PKEY* key)
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        BIGNUM* q = nullptr;
+        if (EVP_PKEY_get_bn_param(key, OSSL_PKEY_PARAM_FFC_Q, &q) != 1)
+            return 0;
+        size_t size = (size_t)BN_num_bytes(q);
+        BN_free(q);
+        return size;
+#else
+        const DSA* dsa = EVP_PKEY_get0_DSA(key);
+        return dsa == nullptr ? 0 : (size_t)BN_num_bytes(DSA_get0_q(dsa));
+#endif
+    }
+}
+
+void DocumentSigner::initialize(std::string certificate, std::string private_key, const std::string& algorithm)
+{
+    SignatureAlgorithm parsed;
+    if (algorithm == "dsa-sha1")
+        parsed = SignatureAlgorithm::DsaSha1;
+    else if (algorithm == "ecdsa-sha256")
+        parsed = SignatureAlgorithm::EcdsaSha256;
+    else if (algorithm == "ed25519")
+        parsed = SignatureAlgorithm::Ed25519;
+    else
+        throw std::invalid_argument("\"" + algorithm + "\" isn't a signature algorithm, expected dsa-sha1, ecdsa-sha256 or ed25519!");
+
+    BIO* bio = BIO_new_mem_buf(private_key.data(), (int)private_key.size());
+    EVP_PKEY* key = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+
+    if (key == nullptr)
+        throw std::invalid_argument("Unable to parse the document signing private key!");
+
+    size_t component_size = 0;
+    if (parsed == SignatureAlgorithm::EcdsaSha256)
+    {
+        if (curve_of(key) != NID_X9_62_prime256v1)
+        {
+            EVP_PKEY_free(key);
+            throw std::invalid_argument("The document signing private key isn't a P-256 key!");
+        }
+        component_size = 32;
+    }
+    else if (parsed == SignatureAlgorithm::Ed25519)
+    {
+        if (EVP_PKEY_id(key) != EVP_PKEY_ED25519)
+        {
+            EVP_PKEY_free(key);
+            throw std::invalid_argument("The document signing private key isn't an Ed25519 key!");
+        }
+    }
+    else if (EVP_PKEY_id(key) == EVP_PKEY_DSA)
+    {
+        component_size = subprime_size(key);
+        if (component_size == 0)
+        {
+            EVP_PKEY_free(key);
+            throw std::invalid_argument("Unable to read the document signing DSA key!");
+        }
+    }
+    else if (EVP_PKEY_id(key) != EVP_PKEY_RSA)
+    {
+        EVP_PKEY_free(key);
+        throw std::invalid_argument("dsa-sha1 needs a DSA or RSA document signing private key!");
+    }
+
+    // NOTE: Signing is only ever set up once at startup, threads that already
+    //       have a signing context would keep using the old key otherwise.
+    EVP_PKEY_free(s_private_key);
+    s_private_key = key;
+    s_algorithm = parsed;
+    s_component_size = component_size;
+    s_certificate = std::move(certificate);
+    s_encoded_certificate = util::base64_encode((const uint8_t*)s_certificate.c_str(), s_certificate.size());
+    s_can_sign = true;
+}
+
+const EVP_MD* DocumentSigner::digest()
+{
+    return s_algorithm == SignatureAlgorithm::DsaSha1 ? EVP_sha1() : EVP_sha256();
+}
+
+const char* DocumentSigner::digest_method()
+{
+    return s_algorithm == SignatureAlgorithm::DsaSha1 ?
+           "http://www.w3.org/2000/09/xmldsig#sha1" :
+           "http://www.w3.org/2001/04/xmlenc#sha256";
+}
+
+const char* DocumentSigner::signature_method()
+{
+    switch (s_algorithm)
+    {
+        case SignatureAlgorithm::EcdsaSha256: return "http://www.w3.org/2001/04/xmldsig-more#ecdsa-sha256";
+        case SignatureAlgorithm::Ed25519: return "http://www.w3.org/2021/04/xmldsig-more#eddsa-ed25519";
+        default:
+            return EVP_PKEY_id(s_private_key) == EVP_PKEY_RSA ?
+                   "http://www.w3.org/2000/09/xmldsig#rsa-sha1" :
+                   "http://www.w3.org/2000/09/xmldsig#dsa-sha1";
+    }
+}
+
+std::vector<uint8_t> DocumentSigner::sign(const std::string_view& signed_info)
+{
+    // Ed25519 hashes the message itself and has to be given it in one piece
+    const EVP_MD* md = s_algorithm == SignatureAlgorithm::Ed25519 ? nullptr : digest();
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx{EVP_MD_CTX_new(), &EVP_MD_CTX_free};
+    if (!ctx || EVP_DigestSignInit(ctx.get(), nullptr, md, nullptr, s_private_key) <= 0)
+        throw std::runtime_error("Unable to set up document signing!");
+
+    std::vector<uint8_t> signature;
+    size_t sig_len = 0;
+    if (EVP_DigestSign(ctx.get(), nullptr, &sig_len, (const uint8_t*)signed_info.data(), signed_info.size()) <= 0)
+        throw std::runtime_error("Unable to sign a document!");
+    signature.resize(sig_len);
+    if (EVP_DigestSign(ctx.get(), signature.data(), &sig_len, (const uint8_t*)signed_info.data(), signed_info.size()) <= 0)
+        throw std::runtime_error("Unable to sign a document!");
+    signature.resize(sig_len);
+
+    if (s_component_size == 0)
+        return signature;
+
+    // XML-DSig wants DSA and ECDSA signatures as r and s back to back
+    // (RFC 3275, RFC 4051), not DER. Both share the same DER layout.
+    const uint8_t* der = signature.data();
+    ECDSA_SIG* sig = d2i_ECDSA_SIG(nullptr, &der, (long)signature.size());
+    if (sig == nullptr)
+        throw std::runtime_error("Unable to decode a document signature!");
+
+    int size = (int)s_component_size;
+    std::vector<uint8_t> raw(s_component_size * 2);
+    bool encoded = BN_bn2binpad(ECDSA_SIG_get0_r(sig), raw.data(), size) == size
+                   && BN_bn2binpad(ECDSA_SIG_get0_s(sig), raw.data() + size, size) == size;
+    ECDSA_SIG_free(sig);
+    if (!encoded)
+        throw std::runtime_error("Unable to encode a document signature!");
+    return raw;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+enum class SignatureAlgorithm : uint8_t
+{
+    // The original algorithm, SHA-1 with whichever key type was given (DSA or RSA)
+    DsaSha1,
+    // ECDSA on P-256 with SHA-256
+    EcdsaSha256,
+    // Ed25519, with SHA-256 for the document reference
+    Ed25519
+};
+
+/**
+ * Holds the document signing key and certificate. Documents themselves are
+ * written by XmlWriter, which signs them through here.
+ */
+class DocumentSigner
+{
+    static std::string s_certificate;
+    static std::string s_encoded_certificate;
+    static EVP_PKEY* s_private_key;
+    static SignatureAlgorithm s_algorithm;
+    // How large r and s are for DSA and ECDSA keys, 0 when the signature is used as is
+    static size_t s_component_size;
+    static bool s_can_sign;
+public:
+    DocumentSigner() = delete;
+
+    /**
+     * Parses the document signing key and encodes the certificate, both are
+     * kept for the lifetime of the process.
+     *
+     * @param certificate The PEM certificate to embed in signatures
+     * @param private_key The PEM private key to sign with
+     * @param algorithm One of "dsa-sha1", "ecdsa-sha256" or "ed25519"
+     * @throws std::invalid_argument Thrown if the private key can't be parsed or doesn't fit the algorithm
+     */
+    static void initialize(std::string certificate, std::string private_key, const std::string& algorithm = "dsa-sha1");
+
+    inline static bool can_sign() { return s_can_sign; }
+    inline static const std::string& certificate() { return s_certificate; }
+    // The certificate, base64 encoded for X509Certificate
+    inline static const std::string& encoded_certificate() { return s_encoded_certificate; }
+
+    // The digest used for the document reference, and for the signature unless it's Ed25519
+    static const EVP_MD* digest();
+    static const char* digest_method();
+    static const char* signature_method();
+
+    /**
+     * Signs the canonical SignedInfo of a document.
+     *
+     * @returns The signature in the form XML-DSig expects for SignatureValue
+     * @throws std::runtime_error Thrown if OpenSSL fails to sign
+     */
+    static std::vector<uint8_t> sign(const std::string_view& signed_info);
+};
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "static_document.hpp"
+
+#include "body_response.hpp"
+
+StaticDocument::StaticDocument(std::string body, std::string content_type) : p_content_type(std::move(content_type))
+{
+    // Bodies that are too small to shrink are always sent as is
+    if (body.size() >= compression::MIN_SIZE)
+    {
+        for (auto encoding : { compression::Encoding::Gzip, compression::Encoding::Zstd })
+        {
+            if (compression::from_name(compression::name(encoding)))
+                p_bodies[(size_t)encoding] = std::make_shared<const std::string>(compression::compress(body, encoding));
+        }
+    }
+    p_bodies[(size_t)compression::Encoding::Identity] = std::make_shared<const std::string>(std::move(body));
+}
+
+std::shared_ptr<httpserver::http_response> StaticDocument::response(compression::Encoding encoding) const
+{
+    if (!p_bodies[(size_t)encoding])
+        encoding = compression::Encoding::Identity;
+
+    auto response = std::make_shared<body_response>(p_bodies[(size_t)encoding], 200, p_content_type);
+    if (encoding != compression::Encoding::Identity)
+        response->with_header("Content-Encoding", compression::name(encoding));
+    response->with_header("Vary", "Accept-Encoding");
+    return response;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <array>
+
+#include <httpserver.hpp>
+
+#include "compression.hpp"
+
+/**
+ * A response body that never changes, e.g. the list of models. It's rendered
+ * once at startup along with an encoded variant for every encoding that's
+ * turned on, so sending it is only a lookup.
+ *
+ * Has to be created after compression::configure().
+ */
+class StaticDocument
+{
+public:
+    StaticDocument() = default;
+    StaticDocument(std::string body, std::string content_type);
+
+    /**
+     * @returns A response sending the body encoded with `encoding`, or as is
+     *          if there's no such variant
+     */
+    [[nodiscard]] std::shared_ptr<httpserver::http_response> response(compression::Encoding encoding) const;
+
+private:
+    std::string p_content_type;
+    // Indexed by encoding, identity is always there
+    std::array<std::shared_ptr<const std::string>, 3> p_bodies;
+};
@@ -1,27 +1,29 @@
 #include "utilities.hpp"
 
 #include <vector>
+#include <algorithm>
 #include <locale>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 #include <openssl/bio.h>
 
-#include "helpers/xml_builder.hpp"
+#include <zlib.h>
+
+#include "helpers/document_writer.hpp"
 
 std::string util::base64_encode(const uint8_t* buffer, size_t length)
 {
-    EVP_ENCODE_CTX* ctx = EVP_ENCODE_CTX_new();
-    EVP_EncodeInit(ctx);
-
+    // NOTE: EVP_EncodeBlock writes a single line without the trailing newline
+    //       EVP_EncodeUpdate adds, and leaves room for its NUL terminator.
     std::string output;
-    output.resize(EVP_ENCODE_LENGTH(length));
+    output.resize(4 * ((length + 2) / 3) + 1);
 
-    int outlen;
-    EVP_EncodeUpdate(ctx, (uint8_t*)output.data(), &outlen, buffer, (int)length);
-    EVP_EncodeFinal(ctx, (uint8_t*)output.data(), &outlen);
-    EVP_ENCODE_CTX_free(ctx);
+    int outlen = EVP_EncodeBlock((uint8_t*)output.data(), buffer, (int)length);
+    output.resize(outlen < 0 ? 0 : (size_t)outlen);
 
     return output;
 }
@@ -40,15 +42,137 @@ std::string util::read_file(const std::string_view& filename)
     return out;
 }
 
-std::shared_ptr<httpserver::string_response> util::make_xml_error(const std::string_view& msg, int code)
+std::shared_ptr<body_response> util::make_xml_error(const std::string_view& msg, int code)
+{
+    return make_error(msg, code, OutputFormat::Xml);
+}
+
+std::shared_ptr<body_response> util::make_error(const std::string_view& msg, int code, OutputFormat format)
 {
-    using ::httpserver::string_response;
+    // Errors aren't tabular, so Arrow clients get them as XML
+    if (format == OutputFormat::Arrow)
+        format = OutputFormat::Xml;
 
-    XmlBuilder b;
-    b
-        .add_signature()
+    auto writer = DocumentWriter::create(format, false);
+    writer->
+        add_signature()
         .add_child("Data")
             .add_string("Error", msg);
 
-    return std::make_shared<string_response>(b.serialize(), code, "application/xml");
-}
\ No newline at end of file
+    return std::make_shared<body_response>(writer->serialize(), code, DocumentWriter::content_type(format));
+}
+
+std::optional<OutputFormat> util::negotiate_format(const httpserver::http_request& req)
+{
+    auto args = req.get_args();
+    if (args.find("format") != args.end())
+    {
+        auto format = to_lower(req.get_arg("format"));
+        if (format == "json")
+            return OutputFormat::Json;
+        else if (format == "xml")
+            return OutputFormat::Xml;
+        else if (format == "arrow")
+            return OutputFormat::Arrow;
+        return std::nullopt;
+    }
+
+    // NOTE: Quality values are ignored, whichever of the types is listed first wins.
+    auto accept = to_lower(req.get_header("Accept"));
+    auto json = accept.find("application/json");
+    auto arrow = accept.find("application/vnd.apache.arrow.stream");
+    auto xml = std::min(accept.find("application/xml"), accept.find("text/xml"));
+    if (json != std::string::npos && json < xml && json < arrow)
+        return OutputFormat::Json;
+    if (arrow != std::string::npos && arrow < xml)
+        return OutputFormat::Arrow;
+    return OutputFormat::Xml;
+}
+
+uint32_t util::checksum(const std::string_view& data)
+{
+    auto crc = crc32(0L, Z_NULL, 0);
+    const char* next = data.data();
+    size_t size = data.size();
+    // crc32() takes the length as a uInt
+    while (size > 0)
+    {
+        auto chunk = (uInt)std::min<size_t>(size, 1u << 30);
+        crc = crc32(crc, (const Bytef*)next, chunk);
+        next += chunk;
+        size -= chunk;
+    }
+    return (uint32_t)crc;
+}
+
+std::string util::entity_tag(size_t size, uint32_t checksum)
+{
+    std::stringstream ss;
+    ss << '"' << std::hex << size << '-' << std::setw(8) << std::setfill('0') << checksum << '"';
+    return ss.str();
+}
+
+bool util::etag_matches(const std::string_view& if_none_match, const std::string_view& etag)
+{
+    size_t start = 0;
+    while (start < if_none_match.size())
+    {
+        auto end = std::min(if_none_match.find(',', start), if_none_match.size());
+        auto tag = if_none_match.substr(start, end - start);
+        start = end + 1;
+
+        auto first = tag.find_first_not_of(" \t");
+        if (first == std::string_view::npos)
+            continue;
+        tag = tag.substr(first, tag.find_last_not_of(" \t") - first + 1);
+
+        if (tag == "*")
+            return true;
+        if (tag.substr(0, 2) == "W/")
+            tag.remove_prefix(2);
+        if (tag == etag)
+            return true;
+    }
+    return false;
+}
+
+std::optional<util::ByteRange> util::parse_range(const std::string_view& header, size_t size)
+{
+    constexpr std::string_view UNIT = "bytes=";
+    if (header.substr(0, UNIT.size()) != UNIT)
+        return std::nullopt;
+
+    auto spec = header.substr(UNIT.size());
+    auto dash = spec.find('-');
+    if (dash == std::string_view::npos || spec.find(',') != std::string_view::npos)
+        return std::nullopt;
+
+    auto parse = [](const std::string_view& str, size_t& out) {
+        auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
+        return !str.empty() && ec == std::errc{} && end == str.data() + str.size();
+    };
+
+    size_t first, last;
+    auto first_str = spec.substr(0, dash), last_str = spec.substr(dash + 1);
+    if (first_str.empty())
+    {
+        // bytes=-N is the last N bytes
+        if (!parse(last_str, last))
+            return std::nullopt;
+        if (last == 0 || size == 0)
+            return ByteRange{ 0, 0 };
+        auto length = std::min(last, size);
+        return ByteRange{ size - length, length };
+    }
+
+    if (!parse(first_str, first))
+        return std::nullopt;
+    if (last_str.empty())
+        last = size - 1;
+    else if (!parse(last_str, last) || last < first)
+        return std::nullopt;
+
+    if (first >= size)
+        return ByteRange{ 0, 0 };
+    return ByteRange{ first, std::min(last, size - 1) - first + 1 };
+}
@@ -7,17 +7,42 @@
 #include <vector>
 #include <memory>
 #include <cassert>
+#include <optional>
 
 #include <httpserver.hpp>
 
+#include "document_writer.hpp"
+#include "body_response.hpp"
+
 namespace util
 {
+    /**
+     * A non-owning view over a contiguous range of elements, a stand-in
+     * for C++20's std::span.
+     */
+    template<class T>
+    struct span
+    {
+        T* first = nullptr;
+        size_t count = 0;
+
+        [[nodiscard]] inline T* begin() const noexcept { return first; }
+        [[nodiscard]] inline T* end() const noexcept { return first + count; }
+        [[nodiscard]] inline size_t size() const noexcept { return count; }
+        [[nodiscard]] inline bool empty() const noexcept { return count == 0; }
+        inline T& operator[](size_t idx) const noexcept { return first[idx]; }
+    };
+
+    // NOTE: A span is treated like a vector by these traits, since everything
+    //       that checks them only cares about iterating over the elements.
     template<class N> struct is_vector { static constexpr bool value = false; };
     template<class N, class A> struct is_vector<std::vector<N, A>> { static constexpr bool value = true; };
+    template<class N> struct is_vector<span<N>> { static constexpr bool value = true; };
     template<class T> inline constexpr bool is_vector_v = is_vector<T>::value;
 
     template<class N> struct vector_type { using type = void; using allocator = void; };
     template<class N, class A> struct vector_type<std::vector<N, A>> { using type = N; using allocator = A; };
+    template<class N> struct vector_type<span<N>> { using type = std::remove_const_t<N>; using allocator = void; };
     template<class T> using vector_type_t = typename vector_type<T>::type;
     template<class T> using vector_type_a = typename vector_type<T>::allocator;
 
@@ -42,13 +67,68 @@ namespace util
 
     std::string base64_encode(const uint8_t* buffer, size_t length);
     std::string read_file(const std::string_view& filename);
-    std::shared_ptr<httpserver::string_response> make_xml_error(const std::string_view& msg, int code);
+    std::shared_ptr<body_response> make_xml_error(const std::string_view& msg, int code);
+    std::shared_ptr<body_response> make_error(const std::string_view& msg, int code, OutputFormat format);
+
+    /**
+     * Picks the format to respond in, from the `format` argument if there is
+     * one (xml, json or arrow), otherwise from the Accept header. XML is the default.
+     *
+     * @returns The format, or std::nullopt if `format` isn't a known format
+     */
+    std::optional<OutputFormat> negotiate_format(const httpserver::http_request& req);
+
+    /**
+     * @returns The CRC-32 of `data`, which is also what cache store entries are checked with
+     */
+    uint32_t checksum(const std::string_view& data);
+
+    /**
+     * A strong entity tag for a body of `size` bytes with the CRC-32 `checksum`.
+     * It's derived from the bytes themselves, so it's the same for every
+     * server that sends them.
+     */
+    std::string entity_tag(size_t size, uint32_t checksum);
+
+    /**
+     * Checks an If-None-Match header against an entity tag, using the weak
+     * comparison that If-None-Match calls for.
+     */
+    bool etag_matches(const std::string_view& if_none_match, const std::string_view& etag);
+
+    struct ByteRange
+    {
+        size_t offset;
+        size_t length;
+    };
+
+    /**
+     * Parses a Range header for a body of `size` bytes. Only a single range
+     * is supported, since multipart/byteranges isn't.
+     *
+     * @returns Nothing if the header should be ignored (it's missing, malformed
+     *          or asks for several ranges), or a range with a length of 0 if
+     *          it can't be satisfied
+     */
+    std::optional<ByteRange> parse_range(const std::string_view& header, size_t size);
+
     inline std::string to_lower(std::string str)
     {
         std::transform(str.begin(), str.end(), str.begin(), ::tolower);
         return str;
     }
 
+    /**
+     * Compares a string to one that's already lowercase, ignoring the case
+     * of the first string, without allocating.
+     */
+    inline bool iequals(const std::string_view& str, const std::string_view& lower)
+    {
+        return str.size() == lower.size() && std::equal(str.begin(), str.end(), lower.begin(), [](char a, char b) {
+            return ::tolower((unsigned char)a) == b;
+        });
+    }
+
     template<typename T>
     struct parse_result
     {
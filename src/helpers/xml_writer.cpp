@@ -0,0 +1,283 @@
+#include "xml_writer.hpp"
+
+#include "utilities.hpp"
+#include "signer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+constexpr std::string_view XML_DECLARATION = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+
+constexpr std::string_view DSIG_NAMESPACE = "http://www.w3.org/2000/09/xmldsig#";
+
+/**
+ * Appends a string with the characters that are special to XML escaped, the
+ * same way Canonical XML escapes text nodes and attribute values.
+ */
+static void append_escaped(std::string& out, const std::string_view& str, bool attribute)
+{
+    const char* special = attribute ? "&<\"\n\r\t" : "&<>\r";
+
+    size_t start = 0;
+    while (start < str.size())
+    {
+        auto pos = str.find_first_of(special, start);
+        if (pos == std::string_view::npos)
+            break;
+
+        out.append(str.data() + start, pos - start);
+        switch (str[pos])
+        {
+            case '&': out.append("&amp;"); break;
+            case '<': out.append("&lt;"); break;
+            case '>': out.append("&gt;"); break;
+            case '"': out.append("&quot;"); break;
+            case '\n': out.append("&#xA;"); break;
+            case '\r': out.append("&#xD;"); break;
+            case '\t': out.append("&#x9;"); break;
+            default: break;
+        }
+        start = pos + 1;
+    }
+
+    if (start < str.size())
+        out.append(str.data() + start, str.size() - start);
+}
+
+XmlWriter::XmlWriter(bool pretty, sink output, size_t flush_threshold)
+    : DocumentWriter(std::move(output), flush_threshold), p_pretty(pretty)
+{
+    p_buffer.append(XML_DECLARATION);
+    p_digest_skip = XML_DECLARATION.size();
+    open_tag("Envelope", {{ "xmlns", "urn:envelope" }});
+}
+
+XmlWriter::~XmlWriter()
+{
+    EVP_MD_CTX_free(p_digest);
+}
+
+DocumentWriter& XmlWriter::add_string(const std::string_view& name, const attribute_map& attributes, const std::string_view& data)
+{
+    open_tag(name, attributes);
+    if (!data.empty())
+    {
+        close_pending_tag();
+        append_escaped(p_buffer, data, false);
+    }
+    return step_up();
+}
+
+DocumentWriter& XmlWriter::add_child(const std::string_view& name, const attribute_map& attributes)
+{
+    open_tag(name, attributes);
+    return *this;
+}
+
+DocumentWriter& XmlWriter::add_empty(const std::string_view& name, const attribute_map& attributes)
+{
+    open_tag(name, attributes);
+    return step_up();
+}
+
+DocumentWriter& XmlWriter::begin_array(const std::string_view& name, const attribute_map& attributes)
+{
+    open_tag(name, attributes);
+    return *this;
+}
+
+DocumentWriter& XmlWriter::add_signature()
+{
+    if (p_flushed)
+        throw std::logic_error("add_signature() has to be called before any output is flushed");
+
+    if (DocumentSigner::can_sign())
+    {
+        this->p_add_signature = true;
+        this->p_canonical = true;
+    }
+    return *this;
+}
+
+DocumentWriter& XmlWriter::step_up()
+{
+    // The envelope is only ever closed by finish()
+    if (p_open.size() <= 1)
+        return *this;
+
+    auto element = std::move(p_open.back());
+    p_open.pop_back();
+
+    if (p_tag_pending && !p_canonical)
+    {
+        p_buffer.append("/>");
+        p_tag_pending = false;
+    }
+    else
+    {
+        close_pending_tag();
+        if (element.has_children)
+            indent();
+        p_buffer.append("</");
+        p_buffer.append(element.name);
+        p_buffer.push_back('>');
+    }
+
+    flush(false);
+    return *this;
+}
+
+void XmlWriter::finish()
+{
+    if (p_finished)
+        return;
+
+    while (p_open.size() > 1)
+        step_up();
+
+    if (p_add_signature)
+        write_signature();
+
+    if (p_tag_pending)
+        p_buffer.append("/>\n");
+    else
+        p_buffer.append(p_pretty && p_open.back().has_children ? "\n</Envelope>\n" : "</Envelope>\n");
+    p_tag_pending = false;
+
+    p_open.clear();
+    p_finished = true;
+    flush(true);
+}
+
+void XmlWriter::open_tag(const std::string_view& name, const attribute_map& attributes)
+{
+    close_pending_tag();
+    if (!p_open.empty())
+    {
+        p_open.back().has_children = true;
+        indent();
+    }
+
+    p_buffer.push_back('<');
+    p_buffer.append(name);
+    if (attributes.size() > 1)
+    {
+        // Canonical XML orders attributes by name
+        std::vector<const attribute_map::value_type*> sorted;
+        sorted.reserve(attributes.size());
+        for (const auto& attribute : attributes)
+            sorted.push_back(&attribute);
+        std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->first < b->first; });
+        for (const auto* attribute : sorted)
+            append_attribute(attribute->first, attribute->second);
+    }
+    else
+    {
+        for (const auto& [attribute, value] : attributes)
+            append_attribute(attribute, value);
+    }
+
+    p_open.push_back({ std::string{name}, false });
+    p_tag_pending = true;
+}
+
+void XmlWriter::append_attribute(const std::string_view& name, const std::string_view& value)
+{
+    p_buffer.push_back(' ');
+    p_buffer.append(name);
+    p_buffer.append("=\"");
+    append_escaped(p_buffer, value, true);
+    p_buffer.push_back('"');
+}
+
+void XmlWriter::close_pending_tag()
+{
+    if (p_tag_pending)
+    {
+        p_buffer.push_back('>');
+        p_tag_pending = false;
+    }
+}
+
+void XmlWriter::indent()
+{
+    if (p_pretty)
+    {
+        p_buffer.push_back('\n');
+        p_buffer.append(p_open.size() * 2, ' ');
+    }
+}
+
+void XmlWriter::on_flush(const std::string_view& chunk)
+{
+    if (p_add_signature)
+        update_digest(chunk);
+}
+
+void XmlWriter::update_digest(std::string_view data)
+{
+    if (p_digest == nullptr)
+    {
+        p_digest = EVP_MD_CTX_new();
+        if (p_digest == nullptr || EVP_DigestInit_ex(p_digest, DocumentSigner::digest(), nullptr) != 1)
+            throw std::runtime_error("Unable to set up the document digest!");
+    }
+
+    // Canonical XML drops the XML declaration
+    size_t skip = std::min(p_digest_skip, data.size());
+    data.remove_prefix(skip);
+    p_digest_skip -= skip;
+
+    if (EVP_DigestUpdate(p_digest, data.data(), data.size()) != 1)
+        throw std::runtime_error("Unable to digest a document!");
+}
+
+void XmlWriter::write_signature()
+{
+    // Everything written so far is already canonical, so the reference digest
+    // is the document as the enveloped signature transform sees it: without
+    // the declaration, the Signature element or the trailing newline.
+    close_pending_tag();
+    p_open.back().has_children = true;
+    std::string before_signature = p_pretty ? "\n" + std::string(p_open.size() * 2, ' ') : "";
+    update_digest(p_buffer);
+    update_digest(before_signature);
+    update_digest(p_pretty ? "\n</Envelope>" : "</Envelope>");
+
+    std::vector<uint8_t> hash(EVP_MAX_MD_SIZE);
+    unsigned int hash_len;
+    if (EVP_DigestFinal_ex(p_digest, hash.data(), &hash_len) != 1)
+        throw std::runtime_error("Unable to digest a document!");
+
+    // Everything after this point is part of the signature itself
+    p_add_signature = false;
+
+    // SignatureValue covers the canonical form of SignedInfo, which is written
+    // out exactly as it was signed
+    std::string signed_info;
+    signed_info.append("<SignedInfo xmlns=\"").append(DSIG_NAMESPACE).append("\">")
+        .append("<CanonicalizationMethod Algorithm=\"http://www.w3.org/TR/2001/REC-xml-c14n-20010315#WithComments\"></CanonicalizationMethod>")
+        .append("<SignatureMethod Algorithm=\"").append(DocumentSigner::signature_method()).append("\"></SignatureMethod>")
+        .append("<Reference URI=\"\">")
+        .append("<Transforms><Transform Algorithm=\"http://www.w3.org/2000/09/xmldsig#enveloped-signature\"></Transform></Transforms>")
+        .append("<DigestMethod Algorithm=\"").append(DocumentSigner::digest_method()).append("\"></DigestMethod>")
+        .append("<DigestValue>");
+    append_escaped(signed_info, util::base64_encode(hash.data(), hash_len), false);
+    signed_info.append("</DigestValue></Reference></SignedInfo>");
+
+    auto signature = DocumentSigner::sign(signed_info);
+
+    open_tag("Signature", {{ "xmlns", std::string{DSIG_NAMESPACE} }});
+    close_pending_tag();
+    p_open.back().has_children = true;
+    indent();
+    p_buffer.append(signed_info);
+
+    add_string("SignatureValue", util::base64_encode(signature.data(), signature.size()))
+    .add_child("KeyInfo")
+        .add_child("X509Data")
+            .add_string("X509Certificate", DocumentSigner::encoded_certificate())
+        .step_up()
+    .step_up()
+    .step_up();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "document_writer.hpp"
+
+/**
+ * Writes XML documents without building a tree first. Elements are escaped
+ * and appended straight to an output buffer. When a sink is given the
+ * buffer is handed to it whenever it grows past the flush threshold, so memory
+ * stays bounded no matter how large the document gets.
+ *
+ * Since nothing can be inserted into output that was already written, pretty
+ * printing has to be decided up front, and add_signature() has to be called
+ * before the first flush.
+ */
+class XmlWriter : public DocumentWriter
+{
+public:
+    explicit XmlWriter(bool pretty = false, sink output = nullptr, size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD);
+    ~XmlWriter() override;
+
+    using DocumentWriter::add_string;
+    using DocumentWriter::add_child;
+    using DocumentWriter::add_empty;
+    using DocumentWriter::begin_array;
+
+    [[nodiscard]] OutputFormat format() const noexcept override { return OutputFormat::Xml; }
+
+    DocumentWriter& add_string(const std::string_view& name, const attribute_map& attributes, const std::string_view& data) override;
+    DocumentWriter& add_child(const std::string_view& name, const attribute_map& attributes) override;
+    DocumentWriter& add_empty(const std::string_view& name, const attribute_map& attributes) override;
+    DocumentWriter& begin_array(const std::string_view& name, const attribute_map& attributes) override;
+
+    DocumentWriter& add_signature() override;
+    DocumentWriter& step_up() override;
+
+    void finish() override;
+
+protected:
+    void on_flush(const std::string_view& chunk) override;
+
+private:
+    void open_tag(const std::string_view& name, const attribute_map& attributes);
+    void append_attribute(const std::string_view& name, const std::string_view& value);
+    void close_pending_tag();
+    void indent();
+    void update_digest(std::string_view data);
+    void write_signature();
+
+    struct open_element
+    {
+        std::string name;
+        bool has_children;
+    };
+
+    bool p_pretty;
+    bool p_finished = false;
+    bool p_tag_pending = false;
+    bool p_add_signature = false;
+    // Signed documents are written in Canonical XML so they can be digested as they go
+    bool p_canonical = false;
+
+    std::vector<open_element> p_open;
+
+    EVP_MD_CTX* p_digest = nullptr;
+    size_t p_digest_skip = 0;
+};
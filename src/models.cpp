@@ -10,3 +10,25 @@ std::string_view models::transaction_type_to_string(TransactionType type)
     default: return "unknown Transaction";
     }
 }
+
+
+std::string_view models::merchant_category_to_string(MerchantCategory category)
+{
+    switch (category)
+    {
+    case MerchantCategory::Agricultural: return "Agricultural";
+    case MerchantCategory::Contracted: return "Contracted";
+    case MerchantCategory::TravelAndEntertainment: return "Travel and Entertainment";
+    case MerchantCategory::CarRental: return "Car Rental";
+    case MerchantCategory::Lodging: return "Lodging";
+    case MerchantCategory::Transportation: return "Transportation";
+    case MerchantCategory::Utility: return "Utility";
+    case MerchantCategory::RetailOutlet: return "Retail Outlet";
+    case MerchantCategory::ClothingStore: return "Clothing Store";
+    case MerchantCategory::MiscStore: return "Miscellaneous Store";
+    case MerchantCategory::Business: return "Business";
+    case MerchantCategory::ProfessionalOrMembership: return "Professional or Membership";
+    case MerchantCategory::Government: return "Government";
+    default: return "Unknown";
+    }
+}
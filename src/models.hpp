@@ -49,4 +49,5 @@ namespace models
     };
 
     std::string_view transaction_type_to_string(TransactionType type);
+    std::string_view merchant_category_to_string(MerchantCategory category);
 }
\ No newline at end of file
@@ -3,13 +3,18 @@
 #include <httpserver.hpp>
 
 #include <utility>
+#include <array>
 #include <fstream>
+#include <filesystem>
 
 #include <lmdb++.h>
 #include <nlohmann/json-schema.hpp>
 
 #include "monitors/perf_monitor.hpp"
 #include "monitors/stat_monitor.hpp"
+#include "helpers/compression.hpp"
+#include "helpers/body_response.hpp"
+#include "helpers/static_document.hpp"
 
 namespace resources
 {
@@ -38,19 +43,16 @@ namespace resources
             return req;
         }
 
+        /**
+         * Counts the size of the response before it's compressed. Streamed
+         * responses don't know their size up front, so they aren't counted.
+         */
         inline const Ref<http_response>& log_response(const Ref<http_response>& res)
         {
-            using httpserver::string_response;
-            using httpserver::digest_auth_fail_response;
-
-            auto* resp = res->get_raw_response();
-            char* raw_resp = (char*)resp;
-            raw_resp += sizeof(char*) * 5;
-            raw_resp += sizeof(pthread_mutex_t);
-            raw_resp += sizeof(uint64_t) * 3;
-            size_t size = *((size_t*)raw_resp);
-
-            p_stats->responsePerSecond += (unsigned int)size;
+            if (auto body = std::dynamic_pointer_cast<body_response>(res))
+                p_stats->responsePerSecond += (unsigned int)body->size();
+            else if (auto compressible = std::dynamic_pointer_cast<compression::compressible_response>(res))
+                p_stats->responsePerSecond += (unsigned int)compressible->size();
             return res;
         }
     };
@@ -61,7 +63,7 @@ namespace resources
         explicit name(const Ref<Statistics>& stat_data) : clean_resource(endpoint, family, stat_data) {}\
         const Ref<http_response> method(const http_request& req) override                      \
         {                                                                                      \
-            return log_response(process(log_request(req)));                                    \
+            return compression::encode(req, log_response(process(log_request(req))));         \
         }                                                                                      \
                                                                                                \
         const Ref<http_response> process(const http_request& req);                             \
@@ -77,7 +79,7 @@ namespace resources
                                                                                              \
         const Ref<http_response> method(const http_request& req) override                    \
         {                                                                                    \
-            return log_response(process(log_request(req)));                                  \
+            return compression::encode(req, log_response(process(log_request(req))));       \
         }                                                                                    \
                                                                                              \
         const Ref<http_response> process(const http_request& req);                           \
@@ -100,7 +102,7 @@ namespace resources
 
         METHOD_SIG(render_GET)
         {
-            return log_response(process(log_request(req)));
+            return compression::encode(req, log_response(process(log_request(req))));
         }
 
         const Ref<http_response> process(const http_request& req);
@@ -113,11 +115,76 @@ namespace resources
     namespace model
     {
         LMDB_RESOURCE(get_user, render_GET, "/user", true);
-        LMDB_RESOURCE(get_transaction_types, render_GET, "/transaction_types", true);
+
+        /**
+         * The transaction types never change, so they're rendered once in
+         * every format when the resource is created.
+         */
+        class get_transaction_types : public clean_resource
+        {
+            // Indexed by OutputFormat, there's no Arrow version
+            std::array<StaticDocument, 2> p_documents;
+        public:
+            explicit get_transaction_types(const Ref<Statistics>& stat_data);
+
+            METHOD_SIG(render_GET)
+            {
+                return compression::encode(req, log_response(process(log_request(req))));
+            }
+
+            const Ref<http_response> process(const http_request& req);
+        };
     }
 
     namespace analytics
     {
+        /**
+         * Selects which dimension attributes get copied into columns next to the
+         * transactions when they're loaded, selectors on those attributes then
+         * skip the join entirely.
+         *
+         * @param columns Any of "card_type", "merchant_category", "merchant_online" and "merchant_foreign"
+         * @throws std::invalid_argument Thrown if a column name isn't recognized
+         */
+        void configure_join_columns(const std::vector<std::string>& columns);
+
+        /**
+         * Checks the columns configure_join_columns() would be given, so bad
+         * options are caught while they're parsed.
+         *
+         * @throws std::invalid_argument Thrown if a column name isn't recognized
+         */
+        void validate_join_columns(const std::vector<std::string>& columns);
+
+        /**
+         * Sets how many bytes of responses the result cache keeps in memory,
+         * and of rows kept to derive narrower results from. 0 turns both off.
+         */
+        void configure_result_cache(size_t bytes);
+
+        /**
+         * @returns A fingerprint of the transactions and the dimension tables,
+         *          it changes whenever either of them is replaced
+         */
+        uint64_t dataset_fingerprint(lmdb::env& env);
+
+        /**
+         * Computes the queries listed in `file` in the background, at a low
+         * priority, to fill the caches before clients ask for them.
+         *
+         * Each entry is an object with a "query" such as "merchants" or
+         * "cities/count", optional "options" in the same form as a JSON
+         * query body, and optional "encodings" to warm (identity and gzip
+         * by default).
+         */
+        void prewarm(const std::filesystem::path& file, std::shared_ptr<lmdb::env> env);
+
+        /**
+         * Stops recomputing stale results and prewarming in the background,
+         * has to be called before the LMDB environment is closed.
+         */
+        void stop_background_work();
+
         // TODO: Merge these all of these into the `query_transactions` method.
         LMDB_RESOURCE(get_top5_transactions_by_zip, render_GET, "/top5/transactions/zip", true);
         LMDB_RESOURCE(get_top5_transactions_by_city, render_GET, "/top5/transactions/city", true);
@@ -130,20 +197,16 @@ namespace resources
         {
             Ref<lmdb::env> p_env;
             nlohmann::json_schema::json_validator p_validator{};
+            // The schema and the model list never change, so they're rendered up front
+            StaticDocument p_schema;
+            // Indexed by OutputFormat and then by whether it's pretty printed
+            std::array<std::array<StaticDocument, 2>, 2> p_models;
         public:
-            queries(const Ref<Statistics>& stat_data, std::shared_ptr<lmdb::env> env) :
-                clean_resource("/query", true, stat_data), p_env(std::move(env))
-            {
-                std::ifstream schema("data/schema.json", std::ios::in);
-                nlohmann::json j;
-                schema >> j;
-                schema.close();
-                p_validator.set_root_schema(j);
-            }
+            queries(const Ref<Statistics>& stat_data, std::shared_ptr<lmdb::env> env);
 
             const Ref<http_response> render(const http_request& req) override
             {
-                return log_response(process(log_request(req)));
+                return compression::encode(req, log_response(process(log_request(req))));
             }
 
             const Ref<http_response> process(const http_request& req);
@@ -7,20 +7,39 @@
 #include <filesystem>
 #include <execution>
 #include <set>
+#include <unordered_map>
+#include <chrono>
+#include <numeric>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
+#include <functional>
+
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <spdlog/spdlog.h>
 #include <nlohmann/json.hpp>
 
 #include "models.hpp"
-#include "helpers/xml_builder.hpp"
+#include "dimensions.hpp"
+#include "helpers/signer.hpp"
+#include "helpers/document_writer.hpp"
+#include "helpers/arrow_writer.hpp"
 #include "helpers/utilities.hpp"
+#include "helpers/compression.hpp"
+#include "helpers/formatting.hpp"
+#include "helpers/result_cache.hpp"
 
 using namespace std::literals;
 
 namespace resources::analytics
 {
-    using httpserver::string_response;
-
     template<typename T = std::string>
     auto next_as(std::istream& input, char delim = ',', bool quoted = false) -> decltype(T())
     {
@@ -264,98 +283,7 @@ namespace resources::analytics
     };
     std::map<std::pair<uint16_t, uint8_t>, User> User::cache{};
 
-    struct Location
-    {
-        bool online;
-        bool foreign;
-        uint32_t zip;
-        std::string city;
-        std::string state;
-
-        static Location from_online(bool online)
-        {
-            return { online, false, 0, std::string{}, std::string{} };
-        }
-        static Location from_foreign(bool foreign)
-        {
-            return { false, foreign, 0, std::string{}, std::string{} };
-        }
-        static Location from_zip(uint32_t zip)
-        {
-            return { false, false, zip, std::string{}, std::string{} };
-        }
-        static Location from_city(std::string city)
-        {
-            return { false, false, 0, std::move(city), std::string{} };
-        }
-        static Location from_state(std::string state)
-        {
-            return { false, false, 0, std::string{}, std::move(state) };
-        }
-    };
-
-    struct Merchant
-    {
-        int64_t id{};
-        std::string name;
-        uint mcc{};
-        std::string category;
-        std::vector<Location> locations;
-
-        static std::map<int64_t, Merchant> cache;
-
-        Merchant() = default;
-
-        Merchant(int64_t mid, lmdb::cursor& mc)
-        {
-            MDB_val key{sizeof(mid), &mid};
-            MDB_val val;
-            mdb_cursor_get(mc, &key, &val, MDB_SET);
-            auto* raw = (const uint8_t*)val.mv_data;
-            id = mid;
-            name = next_as<std::string>(raw);
-            mcc = next_as<uint>(raw);
-            auto c = (models::MerchantCategory)next_as(raw);
-            switch (c)
-            {
-                case models::MerchantCategory::Agricultural: category = "Agricultural"; break;
-                case models::MerchantCategory::Contracted: category = "Contracted"; break;
-                case models::MerchantCategory::TravelAndEntertainment: category = "Travel and Entertainment"; break;
-                case models::MerchantCategory::CarRental: category = "Car Rental"; break;
-                case models::MerchantCategory::Lodging: category = "Lodging"; break;
-                case models::MerchantCategory::Transportation: category = "Transportation"; break;
-                case models::MerchantCategory::Utility: category = "Utility"; break;
-                case models::MerchantCategory::RetailOutlet: category = "Retail Outlet"; break;
-                case models::MerchantCategory::ClothingStore: category = "Clothing Store"; break;
-                case models::MerchantCategory::MiscStore: category = "Miscellaneous Store"; break;
-                case models::MerchantCategory::Business: category = "Business"; break;
-                case models::MerchantCategory::ProfessionalOrMembership: category = "Professional or Membership"; break;
-                case models::MerchantCategory::Government: category = "Government"; break;
-            }
-
-            auto size = next_as<uint64_t>(raw);
-            locations.reserve(size);
-            for (uint64_t i = 0; i < size; ++i)
-            {
-                auto online = next_as<uint8_t>(raw) == 1;
-                auto foreign = next_as<uint8_t>(raw) == 1;
-                auto zip = next_as<uint32_t>(raw);
-                auto city = next_as<std::string>(raw);
-                auto state = next_as<std::string>(raw);
-
-                locations.push_back({ online, foreign, zip, city, state });
-            }
-        }
-
-        static Merchant& get(int64_t mid, lmdb::cursor& mc)
-        {
-            if (!cache.count(mid))
-                cache.emplace(mid, Merchant {mid, mc});
-
-            return cache[mid];
-        }
-    };
-    std::map<int64_t, Merchant> Merchant::cache{};
+    using dimensions::Location;
 
     enum class Order
     {
@@ -635,19 +563,434 @@ namespace resources::analytics
         return { true, std::string{} };
     }
 
+    using TransactionList = std::vector<models::Transaction>;
+    using TransactionRefList = std::vector<models::Transaction const*>;
+
+    static std::atomic<bool> processed = false;
+    static std::mutex processing_mutex;
+    static TransactionList transactions;
+    static uint64_t dataset_version = 0;
+
+    /**
+     * Dimension attributes that can be copied next to the transactions when
+     * they're loaded, so selectors on them can be answered without a join.
+     */
+    enum class JoinColumn : uint8_t
+    {
+        CardType = 1 << 0,
+        MerchantCategory = 1 << 1,
+        MerchantOnline = 1 << 2,
+        MerchantForeign = 1 << 3
+    };
+
+    // Values stored in the merchant online/foreign columns, summarizing all of a merchant's locations
+    enum LocationFlags : uint8_t
+    {
+        HasTrue = 1 << 0,
+        HasFalse = 1 << 1,
+        SingleLocation = 1 << 2,
+        MissingMerchant = 1 << 3
+    };
+
+    constexpr uint8_t UNKNOWN_CARD_TYPE = 3;
+    constexpr uint8_t MISSING_MERCHANT_CATEGORY = (uint8_t)models::MerchantCategory::Government + 1;
+
+    /**
+     * One byte per transaction for each denormalized attribute, indexed the
+     * same as `transactions`. Every value is below 64, so a selector on a
+     * column compiles down to a bitmask of the values it accepts.
+     */
+    struct JoinColumns
+    {
+        uint8_t requested = 0;
+        uint8_t built = 0;
+        std::vector<uint8_t> card_type;
+        std::vector<uint8_t> merchant_category;
+        std::vector<uint8_t> merchant_online;
+        std::vector<uint8_t> merchant_foreign;
+    };
+    static JoinColumns join_columns;
+
+    const std::vector<uint8_t>* join_column_for(TransactionField field)
+    {
+        auto built = [](JoinColumn column) { return (join_columns.built & (uint8_t)column) != 0; };
+
+        switch (field)
+        {
+            case TransactionField::CardType:
+                return built(JoinColumn::CardType) ? &join_columns.card_type : nullptr;
+            case TransactionField::MerchantCategory:
+                return built(JoinColumn::MerchantCategory) ? &join_columns.merchant_category : nullptr;
+            case TransactionField::MerchantOnline:
+                return built(JoinColumn::MerchantOnline) ? &join_columns.merchant_online : nullptr;
+            case TransactionField::MerchantForeign:
+                return built(JoinColumn::MerchantForeign) ? &join_columns.merchant_foreign : nullptr;
+            default:
+                return nullptr;
+        }
+    }
+
+    struct ColumnPredicate
+    {
+        const std::vector<uint8_t>* column;
+        uint64_t accept;
+
+        [[nodiscard]] inline bool matches(size_t row) const noexcept
+        {
+            return (accept >> (*column)[row]) & 1u;
+        }
+    };
+
+    /**
+     * Builds the accepted set for an exact match selector, `code_of` turns a selector
+     * value into the column value it stands for, or -1 if no row can have that value.
+     */
+    template<typename Func>
+    uint64_t exact_column_accept(const QuerySelector& selector, uint64_t valid, Func code_of)
+    {
+        uint64_t bits = 0;
+        for (const auto& value : selector.values)
+        {
+            auto code = code_of(util::to_lower(value));
+            if (code >= 0)
+                bits |= 1ull << code;
+        }
+
+        switch (selector.type)
+        {
+            case SelectorType::IsEqual:
+            case SelectorType::IsOneOf:
+                return bits & valid;
+            case SelectorType::IsNotEqual:
+            case SelectorType::IsNotOneOf:
+                return ~bits & valid;
+            default:
+                return 0;
+        }
+    }
+
+    uint64_t location_column_accept(const QuerySelector& selector)
+    {
+        auto values = util::vector_map(selector.values, [&selector](const std::string& v) {
+            auto [ec, value] { util::parse<bool>(util::to_lower(v)) };
+            if (ec == std::errc::invalid_argument || ec == std::errc::result_out_of_range)
+                throw std::runtime_error(selector.field == TransactionField::MerchantOnline ?
+                        "Selector values for Online must be a boolean" :
+                        "Selector values for Foreign must be a boolean");
+            return value;
+        });
+
+        uint64_t accept = 0;
+        for (uint8_t flags = 0; flags < 16; ++flags)
+        {
+            if (flags & LocationFlags::MissingMerchant)
+                continue;
+
+            auto has = [flags](bool v) { return (flags & (v ? LocationFlags::HasTrue : LocationFlags::HasFalse)) != 0; };
+
+            bool matches = false;
+            switch (selector.type)
+            {
+                case SelectorType::Contains: matches = has(values[0]); break;
+                case SelectorType::ContainsOnly: matches = (flags & LocationFlags::SingleLocation) && has(values[0]); break;
+                case SelectorType::ContainsOneOf: matches = std::any_of(values.begin(), values.end(), has); break;
+                case SelectorType::ContainsAllOf: matches = std::all_of(values.begin(), values.end(), has); break;
+                case SelectorType::ContainsNoneOf: matches = std::none_of(values.begin(), values.end(), has); break;
+                default: break;
+            }
+
+            if (matches)
+                accept |= 1ull << flags;
+        }
+
+        return accept;
+    }
+
+    ColumnPredicate compile_column_predicate(const QuerySelector& selector, const std::vector<uint8_t>* column)
+    {
+        switch (selector.field)
+        {
+            case TransactionField::CardType:
+            {
+                uint64_t valid = (1ull << (UNKNOWN_CARD_TYPE + 1)) - 1;
+                return { column, exact_column_accept(selector, valid, [](const std::string& v) -> int {
+                    if (v == "american express") return 0;
+                    else if (v == "visa") return 1;
+                    else if (v == "mastercard") return 2;
+                    else if (v == "unknown") return UNKNOWN_CARD_TYPE;
+                    return -1;
+                }) };
+            }
+            case TransactionField::MerchantCategory:
+            {
+                uint64_t valid = (1ull << MISSING_MERCHANT_CATEGORY) - 1;
+                return { column, exact_column_accept(selector, valid, [](const std::string& v) -> int {
+                    for (uint8_t c = 0; c < MISSING_MERCHANT_CATEGORY; ++c)
+                    {
+                        if (util::iequals(models::merchant_category_to_string((models::MerchantCategory)c), v))
+                            return c;
+                    }
+                    return -1;
+                }) };
+            }
+            default:
+                return { column, location_column_accept(selector) };
+        }
+    }
+
+    uint8_t location_flags(dimensions::LocationList locations, bool dimensions::Location::* field)
+    {
+        uint8_t flags = locations.size() == 1 ? (uint8_t)LocationFlags::SingleLocation : 0;
+        for (const auto& location : locations)
+            flags |= (uint8_t)(location.*field ? LocationFlags::HasTrue : LocationFlags::HasFalse);
+        return flags;
+    }
+
+    /**
+     * The optional ingest stage, copies the requested dimension attributes into
+     * columns next to the freshly loaded transactions.
+     */
+    void build_join_columns(lmdb::txn& rtxn)
+    {
+        if (join_columns.requested == 0)
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+        auto requested = [](JoinColumn column) { return (join_columns.requested & (uint8_t)column) != 0; };
+
+        if (requested(JoinColumn::CardType))
+        {
+            std::unordered_map<uint32_t, uint8_t> card_types;
+
+            auto dbi = lmdb::dbi::open(rtxn, "cards");
+            auto cursor = lmdb::cursor::open(rtxn, dbi);
+            MDB_val key;
+            MDB_val value;
+            bool first = true;
+            while (mdb_cursor_get(cursor, &key, &value, first ? MDB_FIRST : MDB_NEXT) == MDB_SUCCESS)
+            {
+                first = false;
+
+                const auto* raw_key = (const uint8_t*)key.mv_data;
+                uint16_t user;
+                memcpy(&user, raw_key, sizeof(user));
+                uint8_t card = raw_key[sizeof(user)];
+                card_types[((uint32_t)user << 8) | card] = *(const uint8_t*)value.mv_data;
+            }
+            cursor.close();
+
+            join_columns.card_type.resize(transactions.size());
+            for (size_t i = 0; i < transactions.size(); ++i)
+            {
+                auto iter = card_types.find(((uint32_t)transactions[i].user_id << 8) | transactions[i].card_id);
+                join_columns.card_type[i] = iter != card_types.end() && iter->second < UNKNOWN_CARD_TYPE ? iter->second : UNKNOWN_CARD_TYPE;
+            }
+        }
+
+        if (requested(JoinColumn::MerchantCategory) || requested(JoinColumn::MerchantOnline) || requested(JoinColumn::MerchantForeign))
+        {
+            const auto& merchants = dimensions::merchants();
+            if (requested(JoinColumn::MerchantCategory))
+                join_columns.merchant_category.resize(transactions.size());
+            if (requested(JoinColumn::MerchantOnline))
+                join_columns.merchant_online.resize(transactions.size());
+            if (requested(JoinColumn::MerchantForeign))
+                join_columns.merchant_foreign.resize(transactions.size());
+
+            for (size_t i = 0; i < transactions.size(); ++i)
+            {
+                const auto* merchant = merchants.find(transactions[i].merchant_id);
+                if (requested(JoinColumn::MerchantCategory))
+                    join_columns.merchant_category[i] = merchant ? (uint8_t)merchant->category : MISSING_MERCHANT_CATEGORY;
+                if (requested(JoinColumn::MerchantOnline))
+                    join_columns.merchant_online[i] = merchant ? location_flags(merchants.locations(*merchant), &dimensions::Location::online) : (uint8_t)LocationFlags::MissingMerchant;
+                if (requested(JoinColumn::MerchantForeign))
+                    join_columns.merchant_foreign[i] = merchant ? location_flags(merchants.locations(*merchant), &dimensions::Location::foreign) : (uint8_t)LocationFlags::MissingMerchant;
+            }
+        }
+
+        join_columns.built = join_columns.requested;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        spdlog::info("Built denormalized join columns for {} transactions in {}ms", transactions.size(), elapsed.count());
+    }
+
+    uint8_t parse_join_columns(const std::vector<std::string>& columns)
+    {
+        uint8_t parsed = 0;
+        for (const auto& column : columns)
+        {
+            if (column == "card_type") parsed |= (uint8_t)JoinColumn::CardType;
+            else if (column == "merchant_category") parsed |= (uint8_t)JoinColumn::MerchantCategory;
+            else if (column == "merchant_online") parsed |= (uint8_t)JoinColumn::MerchantOnline;
+            else if (column == "merchant_foreign") parsed |= (uint8_t)JoinColumn::MerchantForeign;
+            else throw std::invalid_argument("\"" + column + "\" can't be denormalized, expected card_type, merchant_category, merchant_online or merchant_foreign!");
+        }
+        return parsed;
+    }
+
+    void validate_join_columns(const std::vector<std::string>& columns)
+    {
+        parse_join_columns(columns);
+    }
+
+    void configure_join_columns(const std::vector<std::string>& columns)
+    {
+        join_columns.requested = parse_join_columns(columns);
+    }
+
+    /**
+     * The dimension tables that a field has to be joined against, fields
+     * that live on the transaction itself have no dimension.
+     */
+    enum class Dimension : uint8_t
+    {
+        None = 0,
+        User = 1 << 0,
+        Merchant = 1 << 1
+    };
+
+    Dimension dimension_of(TransactionField field)
+    {
+        switch (field)
+        {
+            case TransactionField::UserFirstName:
+            case TransactionField::UserLastName:
+            case TransactionField::UserEmail:
+            case TransactionField::CardType:
+            case TransactionField::CardExpires:
+            case TransactionField::CardCVV:
+            case TransactionField::CardPan:
+                return Dimension::User;
+            case TransactionField::MerchantName:
+            case TransactionField::MerchantCategory:
+            case TransactionField::MerchantCity:
+            case TransactionField::MerchantState:
+            case TransactionField::MerchantZip:
+            case TransactionField::MerchantOnline:
+            case TransactionField::MerchantForeign:
+                return Dimension::Merchant;
+            default:
+                return Dimension::None;
+        }
+    }
+
+    /**
+     * Selectors split up by what they need to be evaluated, so the cheap
+     * transaction-local checks can run before any dimension is looked up.
+     */
+    struct QueryPlan
+    {
+        uint8_t dimensions = (uint8_t)Dimension::None;
+        std::vector<QuerySelector> local;
+        std::vector<ColumnPredicate> columns;
+        std::vector<QuerySelector> joined;
+    };
+
+    /**
+     * The parts of a transaction that can be requested with `fields=`, anything
+     * that isn't requested is neither serialized nor joined.
+     */
+    enum class ProjectedField : uint16_t
+    {
+        Fraud = 1 << 0,
+        Amount = 1 << 1,
+        User = 1 << 2,
+        Time = 1 << 3,
+        Type = 1 << 4,
+        Merchant = 1 << 5,
+        Location = 1 << 6,
+        Errors = 1 << 7
+    };
+
+    constexpr uint16_t ALL_FIELDS = (1 << 8) - 1;
+
+    ProjectedField projected_field_from_string(const std::string_view& str)
+    {
+        if (str == "fraud") return ProjectedField::Fraud;
+        else if (str == "amount") return ProjectedField::Amount;
+        else if (str == "user" || str == "card") return ProjectedField::User;
+        else if (str == "time" || str == "date") return ProjectedField::Time;
+        else if (str == "type") return ProjectedField::Type;
+        else if (str == "merchant") return ProjectedField::Merchant;
+        else if (str == "location") return ProjectedField::Location;
+        else if (str == "errors") return ProjectedField::Errors;
+        else throw std::invalid_argument("Invalid field");
+    }
+
+    /**
+     * Builds a projection mask out of a list of field names.
+     *
+     * @param names The names of the fields to project
+     * @returns The projection mask, and the invalid name if there is one
+     */
+    template<typename Names>
+    std::pair<uint16_t, std::string> parse_projection(const Names& names)
+    {
+        uint16_t fields = 0;
+        for (const auto& name : names)
+        {
+            std::string temp{name};
+            std::transform(temp.begin(), temp.end(), temp.begin(), ::tolower);
+            if (temp.empty())
+                continue;
+
+            try
+            {
+                fields |= (uint16_t)projected_field_from_string(temp);
+            }
+            catch (std::invalid_argument&)
+            {
+                return { 0, std::string{name} };
+            }
+        }
+        return { fields, std::string{} };
+    }
+
     struct TransactionQueryOptions
     {
         int count = -1;
+        int limit = -1;
+        std::string cursor;
         Order order = Order::Descending;
         bool verbose = false;
         bool strict = false;
         bool pretty = false;
+        uint16_t fields = ALL_FIELDS;
+        OutputFormat format = OutputFormat::Xml;
+        compression::Encoding encoding = compression::Encoding::Identity;
         std::vector<QuerySelector> selectors;
         std::vector<QueryProperty> properties;
+        QueryPlan plan;
+        // Where the result is kept in the result cache, empty if it isn't cached
+        std::string cache_key;
+        // Set when a stale stored result is being recomputed, so it isn't just read back
+        bool refresh = false;
     };
 
-    using TransactionList = std::vector<models::Transaction>;
-    using TransactionRefList = std::vector<models::Transaction const*>;
+    QueryPlan compile_query(const std::vector<QuerySelector>& selectors)
+    {
+        QueryPlan plan;
+        for (const auto& selector : selectors)
+        {
+            auto dimension = dimension_of(selector.field);
+            if (dimension == Dimension::None)
+            {
+                plan.local.push_back(selector);
+            }
+            else if (const auto* column = join_column_for(selector.field))
+            {
+                plan.columns.push_back(compile_column_predicate(selector, column));
+            }
+            else
+            {
+                plan.dimensions |= (uint8_t)dimension;
+                plan.joined.push_back(selector);
+            }
+        }
+
+        return plan;
+    }
 
     template<typename T>
     bool check_field_against_selector(const QuerySelector& selector, T field)
@@ -776,16 +1119,21 @@ namespace resources::analytics
                 }
             });
 
-            auto equals = [&field](const auto& v) { return v == field; };
+            auto equals = [&field](const auto& v) {
+                if constexpr(std::is_same_v<std::string, T> || std::is_same_v<std::string_view, T>)
+                    return util::iequals(field, v);
+                else
+                    return v == field;
+            };
 
             switch (selector.type)
             {
-                case SelectorType::IsEqual: return field == values[0];
-                case SelectorType::IsNotEqual: return field != values[0];
+                case SelectorType::IsEqual: return equals(values[0]);
+                case SelectorType::IsNotEqual: return !equals(values[0]);
                 case SelectorType::InRange: return values[0] <= field && field <= values[1];
                 case SelectorType::IsNotInRange: return !(values[0] <= field && field <= values[1]);
-                case SelectorType::IsOneOf: std::any_of(values.begin(), values.end(), equals);
-                case SelectorType::IsNotOneOf: std::none_of(values.begin(), values.end(), equals);
+                case SelectorType::IsOneOf: return std::any_of(values.begin(), values.end(), equals);
+                case SelectorType::IsNotOneOf: return std::none_of(values.begin(), values.end(), equals);
                 case SelectorType::LessThan: return field < values[0];
                 case SelectorType::LessThanEqual: return field <= values[0];
                 case SelectorType::GreaterThan: return field > values[0];
@@ -795,80 +1143,112 @@ namespace resources::analytics
         }
     }
 
-    bool should_skip_transaction(const models::Transaction& transaction, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor, lmdb::cursor& merchant_cursor, bool strict, const std::vector<QuerySelector>& selectors)
+    bool matches_selector(const QuerySelector& selector, const models::Transaction& transaction, const User* user, const dimensions::Merchant* merchant)
+    {
+        switch (selector.field)
+        {
+            case TransactionField::UserID:
+                return check_field_against_selector(selector, transaction.user_id);
+            case TransactionField::UserFirstName:
+                return check_field_against_selector(selector, user->first_name);
+            case TransactionField::UserLastName:
+                return check_field_against_selector(selector, user->last_name);
+            case TransactionField::UserEmail:
+                return check_field_against_selector(selector, user->email);
+            case TransactionField::CardID:
+                return check_field_against_selector(selector, transaction.card_id);
+            case TransactionField::CardType:
+                return check_field_against_selector(selector, user->card.type);
+            case TransactionField::CardCVV:
+                return check_field_against_selector(selector, user->card.cvv);
+            case TransactionField::CardPan:
+                return check_field_against_selector(selector, user->card.pan);
+            case TransactionField::Amount:
+                return check_field_against_selector(selector, transaction.amount);
+            case TransactionField::Type:
+                return check_field_against_selector(selector, transaction_type_to_selector(transaction.type));
+            case TransactionField::MerchantID:
+                return check_field_against_selector(selector, transaction.merchant_id);
+            case TransactionField::MerchantName:
+                return merchant != nullptr && check_field_against_selector(selector, std::string_view(merchant->name));
+            case TransactionField::MerchantCategory:
+                return merchant != nullptr && check_field_against_selector(selector, models::merchant_category_to_string(merchant->category));
+            case TransactionField::MerchantCity:
+            case TransactionField::MerchantState:
+            case TransactionField::MerchantZip:
+            case TransactionField::MerchantForeign:
+            case TransactionField::MerchantOnline:
+                return merchant != nullptr && check_field_against_selector(selector, dimensions::merchants().locations(*merchant));
+            case TransactionField::City:
+                return check_field_against_selector(selector, transaction.merchant_city);
+            case TransactionField::State:
+                return check_field_against_selector(selector, transaction.merchant_state);
+            case TransactionField::Zip:
+                return check_field_against_selector(selector, transaction.zip);
+            case TransactionField::MCC:
+                return check_field_against_selector(selector, transaction.mcc);
+            case TransactionField::Error:
+                return check_field_against_selector(selector, transaction.errors);
+            case TransactionField::Fraudulent:
+                return check_field_against_selector(selector, transaction.is_fraud);
+            default:
+                return true;
+        }
+    }
+
+    bool should_skip_transaction(const models::Transaction& transaction, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor, bool strict, const QueryPlan& plan)
     {
         if (strict && (transaction.is_fraud || !transaction.errors.empty()))
             return true;
 
-        if (selectors.empty())
+        for (const auto& selector : plan.local)
+        {
+            if (!matches_selector(selector, transaction, nullptr, nullptr))
+                return true;
+        }
+
+        if (!plan.columns.empty())
+        {
+            auto row = (size_t)(&transaction - transactions.data());
+            for (const auto& predicate : plan.columns)
+            {
+                if (!predicate.matches(row))
+                    return true;
+            }
+        }
+
+        if (plan.joined.empty())
             return false;
 
-        auto user = User::get(transaction.user_id, transaction.card_id, user_cursor, card_cursor);
-        auto merchant = Merchant::get(transaction.merchant_id, merchant_cursor);
+        // Only pay for the joins once every transaction-local selector has passed,
+        // and only for the dimensions that the remaining selectors reference.
+        const User* user = nullptr;
+        if (plan.dimensions & (uint8_t)Dimension::User)
+            user = &User::get(transaction.user_id, transaction.card_id, user_cursor, card_cursor);
 
-        for (const auto& selector : selectors)
+        const dimensions::Merchant* merchant = nullptr;
+        if (plan.dimensions & (uint8_t)Dimension::Merchant)
+            merchant = dimensions::merchants().find(transaction.merchant_id);
+
+        for (const auto& selector : plan.joined)
         {
-            switch (selector.field)
-            {
-                case TransactionField::UserID:
-                    return !check_field_against_selector(selector, transaction.user_id);
-                case TransactionField::UserFirstName:
-                    return !check_field_against_selector(selector, user.first_name);
-                case TransactionField::UserLastName:
-                    return !check_field_against_selector(selector, user.last_name);
-                case TransactionField::UserEmail:
-                    return !check_field_against_selector(selector, user.email);
-                case TransactionField::CardID:
-                    return !check_field_against_selector(selector, transaction.card_id);
-                case TransactionField::CardType:
-                    return !check_field_against_selector(selector, user.card.type);
-                case TransactionField::CardCVV:
-                    return !check_field_against_selector(selector, user.card.cvv);
-                case TransactionField::CardPan:
-                    return !check_field_against_selector(selector, user.card.pan);
-                case TransactionField::Amount:
-                    return !check_field_against_selector(selector, transaction.amount);
-                case TransactionField::Type:
-                    return !check_field_against_selector(selector, transaction_type_to_selector(transaction.type));
-                case TransactionField::MerchantID:
-                    return !check_field_against_selector(selector, transaction.merchant_id);
-                case TransactionField::MerchantName:
-                    return !check_field_against_selector(selector, merchant.name);
-                case TransactionField::MerchantCategory:
-                    return !check_field_against_selector(selector, merchant.category);
-                case TransactionField::MerchantCity:
-                case TransactionField::MerchantState:
-                case TransactionField::MerchantZip:
-                case TransactionField::MerchantForeign:
-                case TransactionField::MerchantOnline:
-                    return !check_field_against_selector(selector, merchant.locations);
-                case TransactionField::City:
-                    return !check_field_against_selector(selector, transaction.merchant_city);
-                case TransactionField::State:
-                    return !check_field_against_selector(selector, transaction.merchant_state);
-                case TransactionField::Zip:
-                    return !check_field_against_selector(selector, transaction.zip);
-                case TransactionField::MCC:
-                    return !check_field_against_selector(selector, transaction.mcc);
-                case TransactionField::Error:
-                    return !check_field_against_selector(selector, transaction.errors);
-                case TransactionField::Fraudulent:
-                    return !check_field_against_selector(selector, transaction.is_fraud);
-            }
+            if (!matches_selector(selector, transaction, user, merchant))
+                return true;
         }
 
         return false;
     }
 
-    bool validate_list_against_properties(const TransactionRefList& transactions, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor, lmdb::cursor& merchant_cursor, const std::vector<QueryProperty>& properties)
+    bool validate_list_against_properties(const TransactionRefList& transactions, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor, const std::vector<QueryProperty>& properties)
     {
         for (const auto& property : properties)
         {
             if (property.condition == PropertyCondition::OneOrMore)
             {
+                auto plan = compile_query({ property.selector });
                 for (const auto& transaction : transactions)
                 {
-                    if (!should_skip_transaction(*transaction, user_cursor, card_cursor, merchant_cursor, false, { property.selector }))
+                    if (!should_skip_transaction(*transaction, user_cursor, card_cursor, false, plan))
                         return true;
                 }
                 return false;
@@ -878,44 +1258,45 @@ namespace resources::analytics
         return true;
     }
 
-    void serialize_amount(XmlBuilder& b, long amount) {
-        long dollars, cents;
-        dollars = amount / 100;
-        cents = amount < 0 ? (amount * -1) % 100 : amount % 100;
-        std::ostringstream ss;
-        ss << "$" << dollars << "." << (cents < 10 ? "0" : "") << cents;
-        b.add_string("Amount", ss.str());
+    template<typename Builder>
+    void serialize_amount(Builder& b, long amount) {
+        formatting::buffer buf;
+        b.add_string("Amount", formatting::amount(buf, amount));
     }
-    void serialize_user_card(XmlBuilder& b, uint16_t user_id, uint8_t card_id) {
+    template<typename Builder>
+    void serialize_user_card(Builder& b, uint16_t user_id, uint8_t card_id) {
+        formatting::buffer user_buf, card_buf;
         b.add_empty("User", {
-                {"id", std::to_string(user_id)},
-                {"card", std::to_string(card_id)},
+                {"id", std::string{formatting::integer(user_buf, user_id)}},
+                {"card", std::string{formatting::integer(card_buf, card_id)}},
         });
     }
-    void serialize_user_card(XmlBuilder& b, uint16_t user_id, uint8_t card_id, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor)
+    template<typename Builder>
+    void serialize_user_card(Builder& b, uint16_t user_id, uint8_t card_id, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor)
     {
         auto u = User::get(user_id, card_id, user_cursor, card_cursor);
+        formatting::buffer buf;
         b
-            .add_child("User", {{"id", std::to_string(user_id)}})
+            .add_child("User", {{"id", std::string{formatting::integer(buf, user_id)}}})
                 .add_string("FirstName", u.first_name)
                 .add_string("LastName", u.last_name)
                 .add_string("Email", u.email)
-                .add_child("Card", {{"id", std::to_string(card_id)}})
+                .add_child("Card", {{"id", std::string{formatting::integer(buf, card_id)}}})
                     .add_string("CardType", u.card.type)
-                    .add_string("Expires",
-                        std::to_string(u.card.expire_month) + "/" + std::to_string(u.card.expire_year))
-                    .add_string("CVV", std::to_string(u.card.cvv))
+                    .add_string("Expires", formatting::expiration(buf, u.card.expire_month, u.card.expire_year))
+                    .add_string("CVV", formatting::integer(buf, u.card.cvv))
                     .add_string("PAN", u.card.pan)
                 .step_up()
             .step_up();
     }
-    void serialize_date(XmlBuilder& b, time_t date) {
-        char mb_str[100];
-        std::strftime(mb_str, 100, "%T %m/%d/%Y", std::localtime(&date));
+    template<typename Builder>
+    void serialize_date(Builder& b, time_t date) {
+        formatting::buffer buf;
         b
-                .add_string("DateTime", std::string(mb_str));
+                .add_string("DateTime", formatting::date(buf, date));
     }
-    void serialize_transaction_type(XmlBuilder& b, models::TransactionType type) {
+    template<typename Builder>
+    void serialize_transaction_type(Builder& b, models::TransactionType type) {
         switch (type)
         {
             case models::TransactionType::Chip:
@@ -932,31 +1313,43 @@ namespace resources::analytics
                 break;
         }
     }
-    void serialize_merchant(XmlBuilder& b, int64_t merchant_id, uint mcc) {
+    template<typename Builder>
+    void serialize_merchant(Builder& b, int64_t merchant_id, uint mcc) {
+        formatting::buffer id_buf, mcc_buf;
         b
             .add_empty("Merchant", {
-                    {"id", std::to_string(merchant_id)},
-                    {"mcc", std::to_string(mcc)}
+                    {"id", std::string{formatting::integer(id_buf, merchant_id)}},
+                    {"mcc", std::string{formatting::integer(mcc_buf, mcc)}}
             });
     }
-    void serialize_merchant(XmlBuilder& b, int64_t merchant_id, lmdb::cursor& merchant_cursor)
+    template<typename Builder>
+    void serialize_merchant(Builder& b, int64_t merchant_id)
     {
-        auto m = Merchant::get(merchant_id, merchant_cursor);
+        formatting::buffer buf;
+        const auto* m = dimensions::merchants().find(merchant_id);
+        if (m == nullptr)
+        {
+            b.add_empty("Merchant", {{ "id", std::string{formatting::integer(buf, merchant_id)} }});
+            return;
+        }
+
         b
-            .add_child("Merchant", {{ "id", std::to_string(m.id) }})
-                .add_string("Name", m.name)
-                .add_string("MCC", std::to_string(m.mcc))
-                .add_string("BusinessCategory", m.category)
+            .add_child("Merchant", {{ "id", std::string{formatting::integer(buf, m->id)} }})
+                .add_string("Name", m->name)
+                .add_string("MCC", formatting::integer(buf, m->mcc))
+                .add_string("BusinessCategory", models::merchant_category_to_string(m->category))
             .step_up();
     }
-    void serialize_location(XmlBuilder& b, const std::string& city, const std::string& state, uint32_t zip) {
+    template<typename Builder>
+    void serialize_location(Builder& b, const std::string& city, const std::string& state, uint32_t zip) {
         if (zip != 0)
         {
+            formatting::buffer buf;
             b
                     .add_empty("Location", {
                             {"city", city},
                             {"state", state},
-                            {"zip", std::to_string(zip)}
+                            {"zip", std::string{formatting::integer(buf, zip)}}
                     });
         }
         else if (zip == 0 && !state.empty())
@@ -965,22 +1358,134 @@ namespace resources::analytics
         }
     }
 
-    struct sort_by_amount
+    template<typename Builder>
+    void serialize_transaction(Builder& b, models::Transaction const* t, uint16_t fields, bool verbose, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor)
     {
-        Order order;
+        auto projected = [fields](ProjectedField field) { return (fields & (uint16_t)field) != 0; };
 
-        bool operator()(models::Transaction const* a, models::Transaction const* b) const
+        if (projected(ProjectedField::Fraud))
+            b.add_child("Transaction", {{"fraud", t->is_fraud ? "true" : "false"}});
+        else
+            b.add_child("Transaction");
+        if (projected(ProjectedField::Amount))
+            serialize_amount(b, t->amount);
+        if (projected(ProjectedField::User))
         {
-            return order == Order::Descending ?
-                   std::greater<long>{}(a->amount, b->amount) :
-                   std::less<long>{}(a->amount, b->amount);
+            if (verbose)
+                serialize_user_card(b, t->user_id, t->card_id, user_cursor, card_cursor);
+            else
+                serialize_user_card(b, t->user_id, t->card_id);
         }
-    };
-
-    template<typename T>
-    struct sort_by_count
-    {
-        Order order;
+        if (projected(ProjectedField::Time))
+            serialize_date(b, t->time);
+        if (projected(ProjectedField::Type))
+            serialize_transaction_type(b, t->type);
+        if (projected(ProjectedField::Merchant))
+        {
+            if (verbose)
+                serialize_merchant(b, t->merchant_id);
+            else
+                serialize_merchant(b, t->merchant_id, t->mcc);
+        }
+        if (projected(ProjectedField::Location))
+            serialize_location(b, t->merchant_city, t->merchant_state, t->zip);
+        if (projected(ProjectedField::Errors) && !t->errors.empty())
+        {
+            b.add_array("Errors", t->errors, [](Builder& b, const auto& s) {
+                b.add_string("Error", s);
+            });
+        }
+        b.step_up();
+    }
+
+    /**
+     * The Arrow columns for the projected fields, in the order append_transaction() writes them.
+     * Arrow rows are always flat, there are no verbose users, cards or merchants.
+     */
+    std::vector<ArrowWriter::Column> arrow_columns(uint16_t fields)
+    {
+        using Type = ArrowWriter::Type;
+        auto projected = [fields](ProjectedField field) { return (fields & (uint16_t)field) != 0; };
+
+        std::vector<ArrowWriter::Column> columns;
+        if (projected(ProjectedField::Fraud))
+            columns.push_back({"fraud", Type::Bool});
+        if (projected(ProjectedField::Amount))
+            columns.push_back({"amount_cents", Type::Int64});
+        if (projected(ProjectedField::User))
+        {
+            columns.push_back({"user_id", Type::UInt16});
+            columns.push_back({"card_id", Type::UInt8});
+        }
+        if (projected(ProjectedField::Time))
+            columns.push_back({"time", Type::Timestamp});
+        if (projected(ProjectedField::Type))
+            columns.push_back({"type", Type::Utf8});
+        if (projected(ProjectedField::Merchant))
+        {
+            columns.push_back({"merchant_id", Type::Int64});
+            columns.push_back({"mcc", Type::UInt32});
+        }
+        if (projected(ProjectedField::Location))
+        {
+            columns.push_back({"merchant_city", Type::Utf8});
+            columns.push_back({"merchant_state", Type::Utf8});
+            columns.push_back({"zip", Type::UInt32});
+        }
+        if (projected(ProjectedField::Errors))
+            columns.push_back({"errors", Type::Utf8List});
+        return columns;
+    }
+
+    void append_transaction(ArrowWriter& w, models::Transaction const* t, uint16_t fields)
+    {
+        auto projected = [fields](ProjectedField field) { return (fields & (uint16_t)field) != 0; };
+
+        if (projected(ProjectedField::Fraud))
+            w.append(t->is_fraud);
+        if (projected(ProjectedField::Amount))
+            w.append((int64_t)t->amount);
+        if (projected(ProjectedField::User))
+        {
+            w.append((int64_t)t->user_id);
+            w.append((int64_t)t->card_id);
+        }
+        if (projected(ProjectedField::Time))
+            w.append((int64_t)t->time);
+        if (projected(ProjectedField::Type))
+            w.append(models::transaction_type_to_string(t->type));
+        if (projected(ProjectedField::Merchant))
+        {
+            w.append(t->merchant_id);
+            w.append((int64_t)t->mcc);
+        }
+        if (projected(ProjectedField::Location))
+        {
+            w.append(std::string_view{t->merchant_city});
+            w.append(std::string_view{t->merchant_state});
+            w.append((int64_t)t->zip);
+        }
+        if (projected(ProjectedField::Errors))
+            w.append(t->errors);
+        w.end_row();
+    }
+
+    struct sort_by_amount
+    {
+        Order order;
+
+        bool operator()(models::Transaction const* a, models::Transaction const* b) const
+        {
+            return order == Order::Descending ?
+                   std::greater<long>{}(a->amount, b->amount) :
+                   std::less<long>{}(a->amount, b->amount);
+        }
+    };
+
+    template<typename T>
+    struct sort_by_count
+    {
+        Order order;
 
         using comparisonType = std::pair<T, TransactionRefList>;
 
@@ -992,100 +1497,969 @@ namespace resources::analytics
         }
     };
 
-    static bool processed = false;
-    static TransactionList transactions;
+    uint64_t file_fingerprint(const std::filesystem::path& path)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        auto modified = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+
+        return std::hash<std::string>{}(std::to_string(size) + ":" + std::to_string(modified));
+    }
+
+    /**
+     * Covers the transactions and the dimension tables, since both end up in
+     * responses.
+     */
+    uint64_t fingerprint_dataset(MDB_env* env)
+    {
+        MDB_envinfo info{};
+        mdb_env_info(env, &info);
+
+        auto fingerprint = std::to_string(file_fingerprint("data/transactions.csv"));
+        fingerprint += ":" + std::to_string(file_fingerprint("transactions.mdb/data.mdb"));
+        fingerprint += ":" + std::to_string(info.me_last_txnid);
+        return std::hash<std::string>{}(fingerprint);
+    }
+
+    template<typename Key, typename Sort = sort_by_count<Key>>
+    using count_set = std::set<std::pair<Key, TransactionRefList>, Sort>;
+
+    void read_transactions(lmdb::txn& rtxn)
+    {
+        if (processed)
+            return;
+
+        // Concurrent first queries wait for one of them to load the dataset
+        std::lock_guard lock(processing_mutex);
+        if (processed)
+            return;
+
+        std::ifstream data("data/transactions.csv");
+        std::string line;
+        // Skip Header
+        std::getline(data, line);
+
+        while (std::getline(data, line))
+        {
+            auto transaction = parse_transaction(line);
+            transactions.push_back(transaction);
+        }
+
+        build_join_columns(rtxn);
+        // NOTE: Result cache keys and page cursors are both derived from this,
+        //       so it has to change with the dimension tables too.
+        dataset_version = fingerprint_dataset(rtxn.env());
+        processed = true;
+    }
+
+    static std::vector<uint32_t> amount_index;
+    static std::once_flag amount_index_flag;
+
+    /**
+     * Every transaction index ordered by ascending amount, ties are broken by
+     * the index so the order is stable between requests. This is what
+     * continuation tokens point into.
+     */
+    const std::vector<uint32_t>& transactions_by_amount()
+    {
+        std::call_once(amount_index_flag, [] {
+            amount_index.resize(transactions.size());
+            std::iota(amount_index.begin(), amount_index.end(), 0);
+            std::sort(std::execution::par, amount_index.begin(), amount_index.end(), [](uint32_t a, uint32_t b) {
+                return std::make_pair(transactions[a].amount, a) < std::make_pair(transactions[b].amount, b);
+            });
+        });
+
+        return amount_index;
+    }
+
+    /**
+     * The state of a paginated query, handed to clients as an opaque
+     * continuation token.
+     */
+    struct PageCursor
+    {
+        uint64_t version;
+        uint64_t query;
+        uint64_t position;
+        uint64_t returned;
+        uint32_t limit;
+        Order order;
+
+        [[nodiscard]] std::string encode() const
+        {
+            constexpr const char* digits = "0123456789abcdef";
+
+            uint8_t raw[sizeof(uint64_t) * 4 + sizeof(uint32_t) + 1];
+            uint8_t* ptr = raw;
+            for (auto value : { version, query, position, returned })
+            {
+                memcpy(ptr, &value, sizeof(value));
+                ptr += sizeof(value);
+            }
+            memcpy(ptr, &limit, sizeof(limit));
+            ptr += sizeof(limit);
+            *ptr = (uint8_t)order;
+
+            std::string token;
+            token.reserve(sizeof(raw) * 2);
+            for (auto byte : raw)
+            {
+                token.push_back(digits[byte >> 4]);
+                token.push_back(digits[byte & 0xF]);
+            }
+            return token;
+        }
+
+        static std::optional<PageCursor> decode(const std::string_view& token)
+        {
+            constexpr size_t raw_size = sizeof(uint64_t) * 4 + sizeof(uint32_t) + 1;
+            if (token.size() != raw_size * 2)
+                return std::nullopt;
+
+            uint8_t raw[raw_size];
+            for (size_t i = 0; i < raw_size; ++i)
+            {
+                auto [_, ec] { std::from_chars(token.data() + i * 2, token.data() + i * 2 + 2, raw[i], 16) };
+                if (ec != std::errc())
+                    return std::nullopt;
+            }
+
+            PageCursor cursor{};
+            const uint8_t* ptr = raw;
+            for (auto* value : { &cursor.version, &cursor.query, &cursor.position, &cursor.returned })
+            {
+                memcpy(value, ptr, sizeof(*value));
+                ptr += sizeof(*value);
+            }
+            memcpy(&cursor.limit, ptr, sizeof(cursor.limit));
+            ptr += sizeof(cursor.limit);
+            if (*ptr > (uint8_t)Order::Ascending || cursor.limit == 0)
+                return std::nullopt;
+            cursor.order = (Order)*ptr;
+
+            return cursor;
+        }
+    };
+
+    /**
+     * A hash of everything that decides which rows a query matches, so a
+     * continuation token can't be replayed against a different query.
+     */
+    uint64_t query_fingerprint(const TransactionQueryOptions& options)
+    {
+        std::string canonical = options.strict ? "strict;" : "lenient;";
+        for (const auto& selector : options.selectors)
+        {
+            canonical += std::to_string((int)selector.field) + ":" + std::to_string((int)selector.type);
+            for (const auto& value : selector.values)
+                canonical += ":" + value;
+            canonical += ";";
+        }
+
+        return std::hash<std::string>{}(canonical);
+    }
+
+    constexpr size_t DEFAULT_RESULT_CACHE_SIZE = 256 * 1024 * 1024;
+    static ResultCache result_cache{DEFAULT_RESULT_CACHE_SIZE};
+
+    /**
+     * Writes a selector so that selectors matching the same transactions come
+     * out the same. Values are lowercased unless they're compared case
+     * sensitively (errors), and sorted when their order doesn't matter.
+     */
+    std::string canonical_selector(const QuerySelector& selector)
+    {
+        auto values = selector.values;
+        if (selector.field != TransactionField::Error)
+        {
+            for (auto& value : values)
+                value = util::to_lower(value);
+        }
+
+        switch (selector.type)
+        {
+            case SelectorType::IsOneOf:
+            case SelectorType::IsNotOneOf:
+            case SelectorType::ContainsOneOf:
+            case SelectorType::ContainsAllOf:
+            case SelectorType::ContainsNoneOf:
+                std::sort(values.begin(), values.end());
+                values.erase(std::unique(values.begin(), values.end()), values.end());
+                break;
+            default:
+                break;
+        }
+
+        auto canonical = std::to_string((int)selector.field) + ":" + std::to_string((int)selector.type);
+        // Values are length prefixed, so a value containing a separator can't collide with two values
+        for (const auto& value : values)
+            canonical += ":" + std::to_string(value.size()) + "=" + value;
+        return canonical;
+    }
+
+    /**
+     * The result cache key for a query, every option that changes the
+     * response is part of it, as is the dataset it's computed from. The order
+     * of selectors and properties doesn't matter, all of them have to match.
+     */
+    std::string result_cache_key(const std::string_view& model, const TransactionQueryOptions& options, bool count_only)
+    {
+        std::vector<std::string> selectors;
+        for (const auto& selector : options.selectors)
+            selectors.push_back(canonical_selector(selector));
+        std::sort(selectors.begin(), selectors.end());
+
+        std::vector<std::string> properties;
+        for (const auto& property : options.properties)
+            properties.push_back(std::to_string((int)property.condition) + ":" + canonical_selector(property.selector));
+        std::sort(properties.begin(), properties.end());
+
+        std::string key{model};
+        key += count_only ? "/count" : "";
+        key += ";v=" + std::to_string(dataset_version);
+        key += ";n=" + std::to_string(options.count);
+        key += options.order == Order::Descending ? ";desc" : ";asc";
+        if (!count_only)
+        {
+            key += options.verbose ? ";verbose" : "";
+            key += ";f=" + std::to_string(options.fields);
+        }
+        key += options.strict ? ";strict" : "";
+        key += options.pretty ? ";pretty" : "";
+        key += ";";
+        key += DocumentWriter::extension(options.format);
+        key += ";";
+        key += compression::name(options.encoding);
+        for (const auto& selector : selectors)
+            key += ";s=" + selector;
+        for (const auto& property : properties)
+            key += ";p=" + property;
+        return key;
+    }
+
+    namespace fs = std::filesystem;
+
+    /**
+     * Generates the key that a query's result is stored under, every option
+     * that changes the output has to be part of it.
+     */
+    std::string store_key_for(const std::string_view& model, const TransactionQueryOptions& options, bool count_only)
+    {
+        std::stringstream ss_name;
+        ss_name << model;
+        if (!count_only && options.count > 0)
+            ss_name << "_" << options.count;
+        if (!count_only)
+            ss_name << "_" << (options.order == Order::Descending ? "descending" : "ascending");
+        if (options.verbose && !count_only)
+            ss_name << "_verbose";
+        if (options.fields != ALL_FIELDS && !count_only)
+            ss_name << "_fields" << options.fields;
+        if (options.strict)
+            ss_name << "_strict";
+        if (options.pretty)
+            ss_name << "_pretty";
+        if (count_only)
+            ss_name << "_count";
+        if (DocumentSigner::can_sign())
+            ss_name << "_signed";
+        ss_name << DocumentWriter::extension(options.format);
+        return ss_name.str();
+    }
+
+    /**
+     * @returns The result stored under `key`, or null if there isn't one or
+     *          the query is recomputing it
+     */
+    std::shared_ptr<compression::compressible_response> find_stored(const std::string& key, const TransactionQueryOptions& options)
+    {
+        if (options.refresh)
+            return nullptr;
+        return compression::make_stored_response(key, 200, DocumentWriter::content_type(options.format));
+    }
+
+    // Results with fewer rows than this are built in one go, anything bigger
+    // is serialized while the client reads it.
+    constexpr size_t STREAMING_ROW_THRESHOLD = 2000;
+    constexpr size_t STREAMING_CHUNK_SIZE = 16 * 1024;
+
+    /**
+     * The rows of a query result, either grouped (merchants, cities, ...) or
+     * a flat list of transactions, along with how far along writing them is.
+     */
+    struct ResultSet
+    {
+        struct Group
+        {
+            // Empty for flat results, the rows are written straight into the result element
+            std::string name;
+            DocumentWriter::attribute_map attributes;
+            TransactionRefList rows;
+            // The attribute that holds the group's name in formats where array elements are unnamed
+            std::string key;
+        };
+
+        std::string element;
+        DocumentWriter::attribute_map attributes;
+        std::vector<Group> groups;
+        uint16_t fields = ALL_FIELDS;
+        bool verbose = false;
+
+        size_t group = 0;
+        size_t row = 0;
+        bool started = false;
+
+        [[nodiscard]] size_t size() const
+        {
+            size_t total = 0;
+            for (const auto& g : groups)
+                total += g.rows.size();
+            return total;
+        }
+
+        // Only verbose users and cards are read from LMDB while serializing
+        [[nodiscard]] bool needs_lookups() const
+        {
+            return verbose && (fields & (uint16_t)ProjectedField::User) != 0;
+        }
+
+        /**
+         * Writes the next row of the result.
+         *
+         * @returns false once the whole result has been written
+         */
+        template<typename Builder>
+        bool write_next(Builder& b, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor)
+        {
+            if (!started)
+            {
+                b
+                    .add_signature()
+                    .add_child("Data")
+                    .begin_array(element, attributes);
+                started = true;
+            }
+
+            if (group >= groups.size())
+                return false;
+
+            const auto& g = groups[group];
+            if (row == 0 && !g.name.empty())
+            {
+                if (b.format() != OutputFormat::Xml && !g.key.empty())
+                {
+                    auto attributes = g.attributes;
+                    attributes.emplace(g.key, g.name);
+                    b.add_child(g.name, attributes);
+                }
+                else
+                {
+                    b.add_child(g.name, g.attributes);
+                }
+                b.begin_array("Transactions");
+            }
+
+            if (row < g.rows.size())
+                serialize_transaction(b, g.rows[row++], fields, verbose, user_cursor, card_cursor);
+
+            if (row == g.rows.size())
+            {
+                if (!g.name.empty())
+                    b.step_up().step_up();
+                ++group;
+                row = 0;
+            }
+
+            return group < groups.size();
+        }
+
+        /**
+         * Writes the next row of the result as Arrow, groups are flattened.
+         *
+         * @returns false once the whole result has been written
+         */
+        bool write_next(ArrowWriter& w)
+        {
+            while (group < groups.size() && row >= groups[group].rows.size())
+            {
+                ++group;
+                row = 0;
+            }
+
+            if (group >= groups.size())
+                return false;
+
+            append_transaction(w, groups[group].rows[row++], fields);
+            return true;
+        }
+    };
+
+    /**
+     * The state of a result that's being streamed to a client, owned by the
+     * MHD_Response that's sending it.
+     */
+    struct ResultStream
+    {
+        std::shared_ptr<ResultSet> results;
+        lmdb::env& env;
+
+        std::string pending;
+        size_t offset = 0;
+        bool done = false;
+
+        // The result is written to a temporary file, which is only copied
+        // into the cache store once the whole result has been written.
+        std::string store_key;
+        fs::path partial_file;
+        std::ofstream cache;
+
+        // Set when the client accepts a compressed response, the compressed
+        // output is stored next to the result the same way.
+        std::unique_ptr<compression::StreamEncoder> encoder;
+        fs::path encoded_partial_file;
+        std::ofstream encoded_cache;
+
+        // Exactly one of these is set, depending on the requested format
+        std::unique_ptr<DocumentWriter> writer;
+        std::unique_ptr<ArrowWriter> arrow;
+
+        // The response as it's sent, it goes into the result cache once it's
+        // complete unless it grows too large. The key is cleared if it does.
+        std::string cache_key;
+        std::string captured;
+        size_t capture_limit;
+        std::string content_type;
+        compression::Encoding encoding;
+
+        ResultStream(std::shared_ptr<ResultSet> results, lmdb::env& env, const TransactionQueryOptions& options, std::string store_key)
+            : results(std::move(results)), env(env), store_key(std::move(store_key)), cache_key(options.cache_key),
+              capture_limit(result_cache.max_entry_size()), content_type(DocumentWriter::content_type(options.format)), encoding(options.encoding)
+        {
+            auto sink = [this](const std::string_view& chunk) { write(chunk); };
+            if (options.format == OutputFormat::Arrow)
+                arrow = std::make_unique<ArrowWriter>(arrow_columns(this->results->fields), sink);
+            else
+                writer = DocumentWriter::create(options.format, options.pretty, sink, STREAMING_CHUNK_SIZE);
+
+            if (options.encoding != compression::Encoding::Identity)
+                encoder = std::make_unique<compression::StreamEncoder>(options.encoding);
+
+            if (!this->store_key.empty() && CacheStore::get() != nullptr)
+            {
+                partial_file = partial_path();
+                cache.open(partial_file, std::ios::out | std::ios::trunc | std::ios::binary);
+
+                if (encoder)
+                {
+                    encoded_partial_file = partial_path();
+                    encoded_cache.open(encoded_partial_file, std::ios::out | std::ios::trunc | std::ios::binary);
+                }
+            }
+        }
+
+        static fs::path partial_path()
+        {
+            static std::atomic<uint64_t> s_count = 0;
+            auto name = "utopia-" + std::to_string(getpid()) + "-" + std::to_string(++s_count) + ".partial";
+            return fs::temp_directory_path() / name;
+        }
+
+        ~ResultStream()
+        {
+            std::error_code ec;
+            if (!partial_file.empty())
+            {
+                cache.close();
+                fs::remove(partial_file, ec);
+            }
+            if (!encoded_partial_file.empty())
+            {
+                encoded_cache.close();
+                fs::remove(encoded_partial_file, ec);
+            }
+        }
+
+        void write(const std::string_view& chunk)
+        {
+            if (cache.is_open())
+                cache.write(chunk.data(), (std::streamsize)chunk.size());
+
+            if (encoder)
+                send(encoder->update(chunk));
+            else
+                send(chunk);
+        }
+
+        void send(const std::string_view& data)
+        {
+            pending.append(data);
+            if (encoded_cache.is_open())
+                encoded_cache.write(data.data(), (std::streamsize)data.size());
+
+            if (!cache_key.empty())
+            {
+                if (captured.size() + data.size() > capture_limit)
+                {
+                    cache_key.clear();
+                    captured = std::string{};
+                }
+                else
+                {
+                    captured.append(data);
+                }
+            }
+        }
+
+        void produce(size_t size, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor)
+        {
+            while (!done && pending.size() < size)
+            {
+                if (arrow && !results->write_next(*arrow))
+                {
+                    arrow->finish();
+                    done = true;
+                }
+                else if (writer && !results->write_next(*writer, user_cursor, card_cursor))
+                {
+                    writer->finish();
+                    done = true;
+                }
+
+                if (done && encoder)
+                    send(encoder->finish());
+            }
+        }
+
+        /**
+         * Serializes rows until at least `size` bytes are ready to be sent.
+         */
+        void fill(size_t size)
+        {
+            pending.erase(0, offset);
+            offset = 0;
+
+            if (writer && results->needs_lookups())
+            {
+                // NOTE: The read transaction can't outlive this call, other
+                //       requests may be handled on this thread in between.
+                auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+                auto user_cursor = lmdb::cursor::open(rtxn, lmdb::dbi::open(rtxn, "users"));
+                auto card_cursor = lmdb::cursor::open(rtxn, lmdb::dbi::open(rtxn, "cards"));
+                produce(size, user_cursor, card_cursor);
+                user_cursor.close();
+                card_cursor.close();
+                rtxn.abort();
+            }
+            else
+            {
+                lmdb::cursor none{nullptr};
+                produce(size, none, none);
+            }
+
+            if (done && !cache_key.empty())
+            {
+                auto body = std::make_shared<const std::string>(std::move(captured));
+                std::string_view view = *body;
+                auto etag = util::entity_tag(view.size(), util::checksum(view));
+                result_cache.insert(cache_key, ResultCache::Entry { view, std::move(body), content_type, encoding, std::move(etag) });
+                cache_key.clear();
+            }
+
+            if (done && cache.is_open())
+            {
+                cache.close();
+                encoded_cache.close();
+
+                // The store removes the files once they're written. Storing the result
+                // drops its stale encoded siblings, so the encoded output goes in after it.
+                if (compression::store_file(store_key, std::exchange(partial_file, {})) && !encoded_partial_file.empty())
+                    CacheStore::get()->insert_file(compression::sibling(store_key, encoding), std::exchange(encoded_partial_file, {}));
+            }
+        }
+    };
+
+    ssize_t stream_results(void* cls, uint64_t, char* buffer, size_t max)
+    {
+        auto* stream = (ResultStream*)cls;
+        try
+        {
+            if (stream->offset == stream->pending.size() && !stream->done)
+                stream->fill(max);
+
+            if (stream->offset == stream->pending.size())
+                return MHD_CONTENT_READER_END_OF_STREAM;
+
+            auto size = std::min(max, stream->pending.size() - stream->offset);
+            memcpy(buffer, stream->pending.data() + stream->offset, size);
+            stream->offset += size;
+            return (ssize_t)size;
+        }
+        catch (std::exception& ex)
+        {
+            // There's no way to report an error once the headers are sent,
+            // so the connection is closed and the client sees a truncated document.
+            spdlog::error("Failed to stream a query result: {}", ex.what());
+            return MHD_CONTENT_READER_END_WITH_ERROR;
+        }
+    }
+
+    void free_stream(void* cls)
+    {
+        delete (ResultStream*)cls;
+    }
+
+    /**
+     * A streamed query result that can be sent to any number of requests, e.g.
+     * to every request that waited on the same query. Each one is streamed
+     * from its own copy of the rows, and only the first one fills the caches.
+     */
+    class result_stream_response : public httpserver::http_response
+    {
+    public:
+        result_stream_response(std::shared_ptr<const ResultSet> results, const TransactionQueryOptions& options, lmdb::env& env, std::string store_key)
+            : http_response(200, DocumentWriter::content_type(options.format)), p_results(std::move(results)), p_options(options),
+              p_env(env), p_store_key(std::move(store_key))
+        {
+            if (options.encoding != compression::Encoding::Identity)
+                with_header("Content-Encoding", compression::name(options.encoding));
+            with_header("Vary", "Accept-Encoding");
+        }
+
+        MHD_Response* get_raw_response() override
+        {
+            auto options = p_options;
+            std::string store_key;
+            if (!p_sent.exchange(true))
+                store_key = p_store_key;
+            else
+                options.cache_key.clear();
+
+            auto* stream = new ResultStream(std::make_shared<ResultSet>(*p_results), p_env, options, store_key);
+            auto* raw = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, STREAMING_CHUNK_SIZE, &stream_results, stream, &free_stream);
+            if (raw == nullptr)
+                delete stream;
+            return raw;
+        }
+
+        /**
+         * Writes the result into the cache store without sending it anywhere.
+         */
+        void store()
+        {
+            auto options = p_options;
+            options.cache_key.clear();
+
+            ResultStream stream(std::make_shared<ResultSet>(*p_results), p_env, options, p_store_key);
+            while (!stream.done)
+            {
+                stream.fill(STREAMING_CHUNK_SIZE);
+                stream.offset = stream.pending.size();
+            }
+        }
+
+    private:
+        std::shared_ptr<const ResultSet> p_results;
+        TransactionQueryOptions p_options;
+        lmdb::env& p_env;
+        std::string p_store_key;
+        std::atomic<bool> p_sent = false;
+    };
+
+    /**
+     * Sends a query result, large results are streamed instead of being built
+     * in memory first.
+     *
+     * @param results The result to send
+     * @param store_key Where to store the result, or empty to skip storing it
+     * @param user_cursor A cursor over the `users` dbi, for results that are built in one go
+     * @param card_cursor A cursor over the `cards` dbi, for results that are built in one go
+     */
+    Ref<http_response> respond_with_results(std::shared_ptr<ResultSet> results, const TransactionQueryOptions& options, lmdb::env& env,
+                                            const std::string& store_key, lmdb::cursor& user_cursor, lmdb::cursor& card_cursor)
+    {
+        if (results->size() >= STREAMING_ROW_THRESHOLD)
+        {
+            return std::make_shared<result_stream_response>(std::move(results), options, env, store_key);
+        }
+
+        std::string xml;
+        if (options.format == OutputFormat::Arrow)
+        {
+            ArrowWriter arrow(arrow_columns(results->fields), [&xml](const std::string_view& chunk) { xml.append(chunk); });
+            while (results->write_next(arrow));
+            arrow.finish();
+        }
+        else
+        {
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+            while (results->write_next(*writer, user_cursor, card_cursor));
+            xml = writer->serialize();
+        }
+
+        return compression::make_response(std::move(xml), 200, DocumentWriter::content_type(options.format), store_key);
+    }
+
+    /**
+     * The rows of recent query results, before they're serialized. A query
+     * that's narrower than one of them is answered by filtering and
+     * truncating its rows instead of scanning every transaction:
+     *   a smaller count, from a result with the same selectors
+     *   extra selectors on fields of the transaction itself, or strict
+     *   instead of lenient, from a result without a count
+     *
+     * Results are grouped into families by what has to match exactly, and
+     * only results without properties are kept.
+     */
+    class MaterializedResults
+    {
+    public:
+        explicit MaterializedResults(size_t budget) : p_budget(budget) {}
+
+        struct Entry
+        {
+            std::string family;
+            // Canonical and sorted, see canonical_selector()
+            std::vector<std::string> selectors;
+            bool strict;
+            int count;
+            std::shared_ptr<const ResultSet> results;
+        };
+
+        void set_budget(size_t rows)
+        {
+            std::lock_guard lock(p_mutex);
+            p_budget = rows;
+            evict();
+        }
+
+        /**
+         * @returns An entry that the query can be derived from, the smallest if there are several
+         */
+        std::optional<Entry> find(const std::string& family, const TransactionQueryOptions& options, const std::vector<std::string>& selectors)
+        {
+            std::lock_guard lock(p_mutex);
+            auto best = p_entries.end();
+            for (auto it = p_entries.begin(); it != p_entries.end(); ++it)
+            {
+                if (it->family != family || !subsumes(*it, options, selectors))
+                    continue;
+                if (best == p_entries.end() || it->results->size() < best->results->size())
+                    best = it;
+            }
+
+            if (best == p_entries.end())
+                return std::nullopt;
+            p_entries.splice(p_entries.begin(), p_entries, best);
+            return *best;
+        }
+
+        /**
+         * @returns Whether insert() would keep an entry of `rows` rows
+         */
+        bool fits(size_t rows)
+        {
+            std::lock_guard lock(p_mutex);
+            return rows <= p_budget / ENTRY_FRACTION;
+        }
+
+        void insert(Entry entry)
+        {
+            std::lock_guard lock(p_mutex);
+            if (entry.results->size() > p_budget / ENTRY_FRACTION)
+                return;
+
+            p_rows += entry.results->size();
+            p_entries.push_front(std::move(entry));
+            evict();
+        }
+
+    private:
+        static constexpr size_t ENTRY_FRACTION = 8;
+        // Lookups go through every entry, so there can't be too many
+        static constexpr size_t MAX_ENTRIES = 256;
+
+        static bool subsumes(const Entry& entry, const TransactionQueryOptions& options, const std::vector<std::string>& selectors)
+        {
+            if (!std::includes(selectors.begin(), selectors.end(), entry.selectors.begin(), entry.selectors.end()))
+                return false;
+            if (entry.strict && !options.strict)
+                return false;
+
+            bool filtered = entry.selectors.size() != selectors.size() || entry.strict != options.strict;
+            if (entry.count <= 0)
+                return true;
+            return !filtered && options.count > 0 && options.count <= entry.count;
+        }
+
+        void evict()
+        {
+            while ((p_rows > p_budget || p_entries.size() > MAX_ENTRIES) && !p_entries.empty())
+            {
+                p_rows -= p_entries.back().results->size();
+                p_entries.pop_back();
+            }
+        }
+
+        std::mutex p_mutex;
+        // Most recently used first
+        std::list<Entry> p_entries;
+        size_t p_budget;
+        size_t p_rows = 0;
+    };
+
+    // A row costs a pointer in the materialized results
+    constexpr size_t MATERIALIZED_ROW_SIZE = sizeof(models::Transaction const*);
+    static MaterializedResults materialized_results{DEFAULT_RESULT_CACHE_SIZE / MATERIALIZED_ROW_SIZE};
 
-    template<typename Key, typename Sort = sort_by_count<Key>>
-    using count_set = std::set<std::pair<Key, TransactionRefList>, Sort>;
+    void configure_result_cache(size_t bytes)
+    {
+        result_cache.set_budget(bytes);
+        materialized_results.set_budget(bytes / MATERIALIZED_ROW_SIZE);
+    }
 
-    void read_transactions()
+    /**
+     * Everything a materialized result has to share with a query to answer
+     * it, anything else is either derived or only changes how it's written.
+     */
+    std::string materialized_family(const std::string_view& model, const TransactionQueryOptions& options)
     {
-        if (processed)
-            return;
+        std::string family{model};
+        family += ";v=" + std::to_string(dataset_version);
+        family += options.order == Order::Descending ? ";desc" : ";asc";
+        family += options.verbose ? ";verbose" : "";
+        family += ";f=" + std::to_string(options.fields);
+        return family;
+    }
 
-        std::ifstream data("data/transactions.csv");
-        std::string line;
-        // Skip Header
-        std::getline(data, line);
+    std::vector<std::string> canonical_selectors(const std::vector<QuerySelector>& selectors)
+    {
+        std::vector<std::string> canonical;
+        for (const auto& selector : selectors)
+            canonical.push_back(canonical_selector(selector));
+        std::sort(canonical.begin(), canonical.end());
+        return canonical;
+    }
 
-        while (std::getline(data, line))
+    /**
+     * Answers a query from a materialized result that subsumes it.
+     *
+     * @returns The query's rows, or null if it has to be computed
+     */
+    std::shared_ptr<ResultSet> derive_results(const std::string_view& model, const TransactionQueryOptions& options)
+    {
+        if (!options.properties.empty())
+            return nullptr;
+
+        auto selectors = canonical_selectors(options.selectors);
+        auto entry = materialized_results.find(materialized_family(model, options), options, selectors);
+        if (!entry)
+            return nullptr;
+
+        // Only selectors on the transaction itself are cheap enough to apply here
+        std::vector<QuerySelector> extra;
+        for (const auto& selector : options.selectors)
         {
-            auto transaction = parse_transaction(line);
-            transactions.push_back(transaction);
+            if (!std::binary_search(entry->selectors.begin(), entry->selectors.end(), canonical_selector(selector)))
+                extra.push_back(selector);
         }
+        auto plan = compile_query(extra);
+        if (!plan.joined.empty())
+            return nullptr;
 
-        processed = true;
+        bool filter = !extra.empty() || entry->strict != options.strict;
+
+        auto derived = std::make_shared<ResultSet>(*entry->results);
+        derived->attributes["strict"] = options.strict ? "true" : "false";
+        derived->attributes.erase("count");
+        if (options.count > 0)
+            derived->attributes.emplace("count", std::to_string(options.count));
+
+        lmdb::cursor none{nullptr};
+        std::vector<ResultSet::Group> groups;
+        for (auto& group : derived->groups)
+        {
+            if (filter)
+            {
+                auto skip = [&](models::Transaction const* t) { return should_skip_transaction(*t, none, none, options.strict, plan); };
+                group.rows.erase(std::remove_if(group.rows.begin(), group.rows.end(), skip), group.rows.end());
+            }
+            if (options.count > 0 && (size_t)options.count < group.rows.size())
+                group.rows.erase(group.rows.begin() + options.count, group.rows.end());
+
+            // Groups only exist for rows that matched, flat results always have their one group
+            if (!group.rows.empty() || group.name.empty())
+                groups.push_back(std::move(group));
+        }
+        derived->groups = std::move(groups);
+        return derived;
+    }
+
+    /**
+     * Keeps a query's rows so narrower queries can be derived from them, has
+     * to be called before the rows are written.
+     */
+    void materialize_results(const std::string_view& model, const TransactionQueryOptions& options, const ResultSet& results)
+    {
+        // Checked before the rows are copied, the budget may be rejecting them anyway
+        if (!options.properties.empty() || !materialized_results.fits(results.size()))
+            return;
+
+        materialized_results.insert({
+            materialized_family(model, options),
+            canonical_selectors(options.selectors),
+            options.strict,
+            options.count,
+            std::make_shared<const ResultSet>(results)
+        });
     }
 
-    namespace fs = std::filesystem;
     struct processor
     {
 
         bool count_only;
         TransactionQueryOptions& options;
+        lmdb::env& env;
 
         lmdb::txn rtxn;
         lmdb::cursor user_cursor;
         lmdb::cursor card_cursor;
-        lmdb::cursor merchant_cursor;
 
         virtual std::string_view name() = 0;
 
         processor(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
-            : count_only(count_only), options(options), rtxn(lmdb::txn::begin(env, nullptr, MDB_RDONLY)),
-              user_cursor(nullptr), card_cursor(nullptr), merchant_cursor(nullptr)
+            : count_only(count_only), options(options), env(env), rtxn(lmdb::txn::begin(env, nullptr, MDB_RDONLY)),
+              user_cursor(nullptr), card_cursor(nullptr)
         {
             auto user_dbi = lmdb::dbi::open(rtxn, "users");
             auto card_dbi = lmdb::dbi::open(rtxn, "cards");
-            auto merchant_dbi = lmdb::dbi::open(rtxn, "merchants");
             user_cursor = lmdb::cursor::open(rtxn, user_dbi);
             card_cursor = lmdb::cursor::open(rtxn, card_dbi);
-            merchant_cursor = lmdb::cursor::open(rtxn, merchant_dbi);
         }
 
         Ref<http_response> run()
         {
-            if (!fs::exists("cache"))
-                fs::create_directory("cache");
-
             if (options.selectors.empty() && options.properties.empty())
             {
-                std::stringstream ss_name;
-                ss_name << name();
-                if (!count_only && options.count > 0)
-                    ss_name << "_" << options.count;
-                if (!count_only)
-                    ss_name << "_" << (options.order == Order::Descending ? "descending" : "ascending");
-                if (options.verbose && !count_only)
-                    ss_name << "_verbose";
-                if (options.strict)
-                    ss_name << "_strict";
-                if (options.pretty)
-                    ss_name << "_pretty";
-                if (count_only)
-                    ss_name << "_count";
-                if (XmlBuilder::can_sign())
-                    ss_name << "_signed";
-                ss_name << ".xml";
-                p_cache_file = fs::path("cache") / ss_name.str();
-
-                if (fs::exists(p_cache_file))
-                    return std::make_shared<httpserver::file_response>(p_cache_file.string(), 200, "application/xml");
-            }
-
-            read_transactions();
+                p_store_key = store_key_for(name(), options, count_only);
+
+                if (auto stored = find_stored(p_store_key, options))
+                    return stored;
+            }
+
+            read_transactions(rtxn);
 
             return process();
         }
 
-        void write_cache(const std::string_view& xml)
+        Ref<http_response> respond(std::string xml)
         {
-            if (options.selectors.empty() && options.properties.empty())
-            {
-                std::ofstream out(p_cache_file, std::ios::out | std::ios::trunc);
-                out.write(xml.data(), (std::streamsize)xml.size());
-                out.close();
-            }
+            return compression::make_response(std::move(xml), 200, DocumentWriter::content_type(options.format), p_store_key);
+        }
+
+        Ref<http_response> respond(std::shared_ptr<ResultSet> results)
+        {
+            return respond_with_results(std::move(results), options, env, p_store_key, user_cursor, card_cursor);
         }
 
         virtual Ref<http_response> process() = 0;
@@ -1094,12 +2468,11 @@ namespace resources::analytics
         {
             user_cursor.close();
             card_cursor.close();
-            merchant_cursor.close();
             rtxn.abort();
         }
 
     private:
-        fs::path p_cache_file;
+        std::string p_store_key;
     };
 
     struct merchant_processor : public processor
@@ -1112,12 +2485,17 @@ namespace resources::analytics
 
         Ref<http_response> process() override
         {
+            if (!count_only)
+            {
+                if (auto derived = derive_results(name(), options))
+                    return respond(std::move(derived));
+            }
+
             std::map<int64_t, TransactionRefList> transactions_by_merchant;
 
             for (const auto& item : transactions) try
             {
-                if (should_skip_transaction(item, user_cursor, card_cursor, merchant_cursor, options.strict,
-                        options.selectors))
+                if (should_skip_transaction(item, user_cursor, card_cursor, options.strict, options.plan))
                     continue;
 
                 if (transactions_by_merchant.count(item.merchant_id))
@@ -1126,14 +2504,14 @@ namespace resources::analytics
             }
             catch (std::exception& ex)
             {
-                return util::make_xml_error(ex.what(), 400);
+                return util::make_error(ex.what(), 400, options.format);
             }
 
             if (!options.properties.empty())
             {
                 for (const auto& [merchant, transact_list] : transactions_by_merchant)
                 {
-                    if (!validate_list_against_properties(transact_list, user_cursor, card_cursor, merchant_cursor,
+                    if (!validate_list_against_properties(transact_list, user_cursor, card_cursor,
                             options.properties))
                         transactions_by_merchant.erase(merchant);
                 }
@@ -1159,11 +2537,13 @@ namespace resources::analytics
                     s.erase(iter, s.end());
                 }
 
-                XmlBuilder b;
+                auto writer = DocumentWriter::create(options.format, options.pretty);
+
+                auto& b = *writer;
                 b
                         .add_signature()
                         .add_child("Data")
-                        .add_child("Counts", {
+                        .begin_array("Counts", {
                                 {"order", options.order == Order::Ascending ? "ascending" : "descending"},
                                 {"groupedBy", "merchant"},
                                 {"strict", options.strict ? "true" : "false"}
@@ -1171,55 +2551,27 @@ namespace resources::analytics
                 for (const auto& [merchant, transact_list] : s)
                     b.add_string("Count", {{"merchant", std::to_string(merchant)}}, std::to_string(transact_list.size()));
 
-                std::string xml = b.serialize(options.pretty);
-                write_cache(xml);
-                return std::make_shared<string_response>(xml, 200, "application/xml");
+                std::string xml = b.serialize();
+                return respond(std::move(xml));
             }
 
-            XmlBuilder::attribute_map attributes {
+            auto results = std::make_shared<ResultSet>();
+            results->element = "Results";
+            results->attributes = {
                     {"order", options.order == Order::Descending ? "descending" : "ascending"},
                     {"verbose", options.verbose ? "true" : "false"},
                     {"strict", options.strict ? "true" : "false"},
                     {"groupedBy", "merchant"}
             };
-
             if (options.count > 0)
-                attributes.emplace("count", std::to_string(options.count));
-
-            XmlBuilder builder;
-            builder
-                    .add_signature()
-                    .add_child("Data")
-                    .add_iterator("Results", attributes, transactions_by_merchant.begin(), transactions_by_merchant.end(), [&, &verbose = options.verbose](XmlBuilder& b, const auto& pair) {
-                        auto& [merchant, transact_list] = pair;
-                        b.add_child("Merchant", {{ "id", std::to_string(merchant) }});
-                        b.add_array("Transactions", transact_list, [&](XmlBuilder& b, models::Transaction const* t) {
-                            b.add_child("Transaction", {{"fraud", t->is_fraud ? "true" : "false"}});
-                            serialize_amount(b, t->amount);
-                            if (verbose)
-                                serialize_user_card(b, t->user_id, t->card_id, user_cursor, card_cursor);
-                            else
-                                serialize_user_card(b, t->user_id, t->card_id);
-                            serialize_date(b, t->time);
-                            serialize_transaction_type(b, t->type);
-                            if (verbose)
-                                serialize_merchant(b, t->merchant_id, merchant_cursor);
-                            else
-                                serialize_merchant(b, t->merchant_id, t->mcc);
-                            if (!t->errors.empty())
-                            {
-                                b.add_array("Errors", t->errors, [](XmlBuilder& b, const auto& s) {
-                                    b.add_string("Error", s);
-                                });
-                            }
-                            b.step_up();
-                        });
-                        b.step_up();
-                    });
-
-            std::string xml = builder.serialize(options.pretty);
-            write_cache(xml);
-            return std::make_shared<string_response>(xml, 200, "application/xml");
+                results->attributes.emplace("count", std::to_string(options.count));
+            results->fields = (uint16_t)(options.fields & ~(uint16_t)ProjectedField::Location);
+            results->verbose = options.verbose;
+            for (auto& [merchant, transact_list] : transactions_by_merchant)
+                results->groups.push_back({ "Merchant", {{ "id", std::to_string(merchant) }}, std::move(transact_list), std::string{} });
+
+            materialize_results(name(), options, *results);
+            return respond(std::move(results));
         }
     };
 
@@ -1238,15 +2590,16 @@ namespace resources::analytics
             for (const auto& item : transactions)
                 unique_merchants.insert(item.merchant_id);
 
-            XmlBuilder b;
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+
+            auto& b = *writer;
             b
                 .add_signature()
                 .add_child("Data")
                 .add_string("UniqueMerchants", std::to_string(unique_merchants.size()));
 
-            std::string xml = b.serialize(options.pretty);
-            write_cache(xml);
-            return std::make_shared<string_response>(xml, 200, "application/xml");
+            std::string xml = b.serialize();
+            return respond(std::move(xml));
         }
     };
 
@@ -1288,7 +2641,9 @@ namespace resources::analytics
             auto moreThanOnePercentage = ((double)more_insuff.size() / total) * 100;
             auto nonePercentage = ((double)no_insuff.size() / total) * 100;
 
-            XmlBuilder b;
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+
+            auto& b = *writer;
             b
                 .add_signature()
                 .add_child("Data")
@@ -1297,9 +2652,8 @@ namespace resources::analytics
                         .add_string("MoreThanOne", std::to_string(moreThanOnePercentage) + "%")
                         .add_string("None", std::to_string(nonePercentage) + "%");
 
-            std::string xml = b.serialize(options.pretty);
-            write_cache(xml);
-            return std::make_shared<string_response>(xml, 200, "application/xml");
+            std::string xml = b.serialize();
+            return respond(std::move(xml));
         }
     };
 
@@ -1363,12 +2717,14 @@ namespace resources::analytics
             for (int i = 0; i <= 10; ++i)
                 end++;
 
-            XmlBuilder b;
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+
+            auto& b = *writer;
             b
                 .add_signature()
                 .add_child("Data")
                     .add_child("RecurringTransactions", {{ "by", "merchant" }})
-                        .add_iterator("Merchants", begin, end, [](XmlBuilder& b, const auto& pair) {
+                        .add_iterator("Merchants", begin, end, [](DocumentWriter& b, const auto& pair) {
                             b
                                 .add_child("Merchant", {{"id", std::to_string(pair.first)}});
                             serialize_amount(b, pair.second.first);
@@ -1376,725 +2732,1213 @@ namespace resources::analytics
                             b.step_up();
                         });
 
-            std::string xml = b.serialize(options.pretty);
-            write_cache(xml);
-            return std::make_shared<string_response>(xml, 200, "application/xml");
-        }
-    };
+            std::string xml = b.serialize();
+            return respond(std::move(xml));
+        }
+    };
+
+    const Ref<http_response> process_cities(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    {
+        std::string store_key;
+        if (options.selectors.empty() && options.properties.empty())
+        {
+            store_key = store_key_for("cities", options, count_only);
+
+            if (auto stored = find_stored(store_key, options))
+                return stored;
+        }
+
+        std::map<std::string, TransactionRefList> transactions_by_city;
+
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto user_dbi = lmdb::dbi::open(rtxn, "users");
+        auto card_dbi = lmdb::dbi::open(rtxn, "cards");
+        auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
+        auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
+
+        read_transactions(rtxn);
+
+        if (!count_only)
+        {
+            if (auto derived = derive_results("cities", options))
+                return respond_with_results(std::move(derived), options, env, store_key, user_cursor, card_cursor);
+        }
+
+        for (const auto& item : transactions)
+        {
+            try
+            {
+                if (should_skip_transaction(item, user_cursor, card_cursor, options.strict, options.plan))
+                    continue;
+
+                if (item.merchant_city.empty())
+                    continue;
+
+                if (!transactions_by_city.count(item.merchant_city))
+                    transactions_by_city.emplace(item.merchant_city, std::vector<models::Transaction const*>{});
+                transactions_by_city[item.merchant_city].push_back(&item);
+            }
+            catch (std::exception& ex)
+            {
+                return util::make_error(ex.what(), 400, options.format);
+            }
+        }
+
+        if (!options.properties.empty())
+        {
+            for (auto iter = transactions_by_city.begin(); iter != transactions_by_city.end();)
+            {
+                if (!validate_list_against_properties(iter->second, user_cursor, card_cursor,
+                        options.properties))
+                    iter = transactions_by_city.erase(iter);
+                else
+                    ++iter;
+            }
+        }
+
+        if (!count_only)
+        {
+            for (auto& pair : transactions_by_city)
+            {
+                std::sort(std::execution::par, pair.second.begin(), pair.second.end(), sort_by_amount{ options.order });
+                if (options.count > 0 && options.count < pair.second.size())
+                    pair.second.erase(pair.second.begin() + options.count, pair.second.end());
+            }
+        }
+        else
+        {
+            count_set<std::string> s(transactions_by_city.begin(), transactions_by_city.end(), sort_by_count<std::string>{options.order});
+            if (options.count > 0)
+            {
+                auto iter = s.begin();
+                for (int i = 0; i < options.count && i < s.size(); ++i)
+                    iter++;
+                s.erase(iter, s.end());
+            }
+
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+
+            auto& b = *writer;
+            b
+                .add_signature()
+                .add_child("Data")
+                    .begin_array("Counts", {
+                            {"order", options.order == Order::Ascending ? "ascending" : "descending"},
+                            {"groupedBy", "cities"},
+                            {"strict", options.strict ? "true" : "false"}
+                    });
+            for (const auto& [city, transact_list] : s)
+                b.add_string("Count", {{"city", city}}, std::to_string(transact_list.size()));
+
+            std::string xml = b.serialize();
+            return compression::make_response(std::move(xml), 200, DocumentWriter::content_type(options.format), store_key);
+        }
+
+        auto results = std::make_shared<ResultSet>();
+        results->element = "Results";
+        results->attributes = {
+            {"order", options.order == Order::Descending ? "descending" : "ascending"},
+            {"verbose", options.verbose ? "true" : "false"},
+            {"strict", options.strict ? "true" : "false"},
+            {"groupedBy", "city"}
+        };
+        if (options.count > 0)
+            results->attributes.emplace("count", std::to_string(options.count));
+        results->fields = (uint16_t)(options.fields & ~(uint16_t)ProjectedField::Location);
+        results->verbose = options.verbose;
+        for (auto& [city, transact_list] : transactions_by_city)
+            results->groups.push_back({ city, {}, std::move(transact_list), "city" });
+
+        materialize_results("cities", options, *results);
+        auto response = respond_with_results(std::move(results), options, env, store_key, user_cursor, card_cursor);
+
+        user_cursor.close();
+        card_cursor.close();
+        rtxn.abort();
+
+        return response;
+    }
+
+    const Ref<http_response> process_months(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    {
+        namespace fs = std::filesystem;
+
+        constexpr const char* months[12] {
+            "January",
+            "February",
+            "March",
+            "April",
+            "May",
+            "June",
+            "July",
+            "August",
+            "September",
+            "October",
+            "November",
+            "December"
+        };
+
+        std::string store_key;
+        if (options.selectors.empty() && options.properties.empty())
+        {
+            store_key = store_key_for("months", options, count_only);
+
+            if (auto stored = find_stored(store_key, options))
+                return stored;
+        }
+
+        std::map<int, TransactionRefList> transactions_by_month;
+
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto user_dbi = lmdb::dbi::open(rtxn, "users");
+        auto card_dbi = lmdb::dbi::open(rtxn, "cards");
+        auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
+        auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
+
+        read_transactions(rtxn);
+
+        if (!count_only)
+        {
+            if (auto derived = derive_results("months", options))
+                return respond_with_results(std::move(derived), options, env, store_key, user_cursor, card_cursor);
+        }
+
+        for (const auto& item : transactions)
+        {
+            try
+            {
+                if (should_skip_transaction(item, user_cursor, card_cursor, options.strict, options.plan))
+                    continue;
+
+                struct tm* ptm = gmtime(&item.time);
+                auto month = ptm->tm_mon;
+
+                if (!transactions_by_month.count(month))
+                    transactions_by_month.emplace(month, TransactionRefList {});
+
+                transactions_by_month[month].push_back(&item);
+            }
+            catch (std::exception& ex)
+            {
+                return util::make_error(ex.what(), 400, options.format);
+            }
+        }
+
+        if (!count_only)
+        {
+            for (auto& pair : transactions_by_month)
+            {
+                std::sort(std::execution::par, pair.second.begin(), pair.second.end(), sort_by_amount{ options.order });
+                if (options.count > 0)
+                    pair.second.erase(pair.second.begin() + options.count, pair.second.end());
+            }
+        }
+        else
+        {
+            count_set<int> s(transactions_by_month.begin(),
+                    transactions_by_month.end(), sort_by_count<int>{options.order});
+            if (options.count > 0)
+            {
+                auto iter = s.begin();
+                for (int i = 0; i < options.count; ++i)
+                    iter++;
+                s.erase(iter, s.end());
+            }
+
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+
+            auto& b = *writer;
+            b
+                    .add_signature()
+                    .add_child("Data")
+                        .begin_array("Counts", {
+                            {"order", options.order == Order::Ascending ? "ascending" : "descending"},
+                            {"groupedBy", "months"},
+                            {"strict", options.strict ? "true" : "false"}
+                        });
+            for (const auto& [month, transact_list] : s)
+                b.add_string("Count", {{"month", months[month]}}, std::to_string(transact_list.size()));
+
+            std::string xml = b.serialize();
+            return compression::make_response(std::move(xml), 200, DocumentWriter::content_type(options.format), store_key);
+        }
+
+        auto results = std::make_shared<ResultSet>();
+        results->element = "Results";
+        results->attributes = {
+            {"order", options.order == Order::Descending ? "descending" : "ascending"},
+            {"verbose", options.verbose ? "true" : "false"},
+            {"strict", options.strict ? "true" : "false"},
+            {"groupedBy", "month"}
+        };
+        if (options.count > 0)
+            results->attributes.emplace("count", std::to_string(options.count));
+        results->fields = (uint16_t)(options.fields & ~(uint16_t)ProjectedField::Location);
+        results->verbose = options.verbose;
+        for (auto& [month, transact_list] : transactions_by_month)
+            results->groups.push_back({ months[month], {}, std::move(transact_list), "month" });
+
+        materialize_results("months", options, *results);
+        auto response = respond_with_results(std::move(results), options, env, store_key, user_cursor, card_cursor);
 
-    const Ref<http_response> process_cities(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
-    {
-        namespace fs = std::filesystem;
+        user_cursor.close();
+        card_cursor.close();
+        rtxn.abort();
 
-        if (!fs::exists("cache"))
-            fs::create_directory("cache");
+        return response;
+    }
 
-        fs::path cache_file;
+    const Ref<http_response> process_states(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    {
+        std::string store_key;
         if (options.selectors.empty() && options.properties.empty())
         {
-            std::stringstream ss_name;
-            ss_name << "cities";
-            if (!count_only && options.count > 0)
-                ss_name << "_" << options.count;
-            if (!count_only)
-                ss_name << "_" << (options.order == Order::Descending ? "descending" : "ascending");
-            if (options.verbose && !count_only)
-                ss_name << "_verbose";
-            if (options.strict)
-                ss_name << "_strict";
-            if (options.pretty)
-                ss_name << "_pretty";
-            if (count_only)
-                ss_name << "_count";
-            if (XmlBuilder::can_sign())
-                ss_name << "_signed";
-            ss_name << ".xml";
-            cache_file = fs::path("cache") / ss_name.str();
-
-            if (fs::exists(cache_file))
-                return std::make_shared<httpserver::file_response>(cache_file.string(), 200, "application/xml");
+            store_key = store_key_for("states", options, count_only);
+
+            if (auto stored = find_stored(store_key, options))
+                return stored;
         }
 
-        std::map<std::string, TransactionRefList> transactions_by_city;
+        std::map<std::string, TransactionRefList> transactions_by_state;
 
         auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
         auto user_dbi = lmdb::dbi::open(rtxn, "users");
         auto card_dbi = lmdb::dbi::open(rtxn, "cards");
-        auto merchant_dbi = lmdb::dbi::open(rtxn, "merchants");
         auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
         auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
-        auto merchant_cursor = lmdb::cursor::open(rtxn, merchant_dbi);
 
-        read_transactions();
+        read_transactions(rtxn);
+
+        if (!count_only)
+        {
+            if (auto derived = derive_results("states", options))
+                return respond_with_results(std::move(derived), options, env, store_key, user_cursor, card_cursor);
+        }
 
         for (const auto& item : transactions)
         {
             try
             {
-                if (should_skip_transaction(item, user_cursor, card_cursor, merchant_cursor, options.strict,
-                        options.selectors))
+                if (should_skip_transaction(item, user_cursor, card_cursor, options.strict, options.plan))
                     continue;
 
-                if (item.merchant_city.empty())
+                if (item.merchant_state.empty())
                     continue;
 
-                if (!transactions_by_city.count(item.merchant_city))
-                    transactions_by_city.emplace(item.merchant_city, std::vector<models::Transaction const*>{});
-                transactions_by_city[item.merchant_city].push_back(&item);
+                // Not a state abbreviation, must be a country
+                if (item.merchant_state.size() > 2)
+                    continue;
+
+                if (!transactions_by_state.count(item.merchant_state))
+                    transactions_by_state.emplace(item.merchant_state, TransactionRefList{});
+
+                transactions_by_state[item.merchant_state].push_back(&item);
             }
             catch (std::exception& ex)
             {
-                return util::make_xml_error(ex.what(), 400);
+                return util::make_error(ex.what(), 400, options.format);
             }
         }
 
         if (!options.properties.empty())
         {
-            for (auto iter = transactions_by_city.begin(); iter != transactions_by_city.end();)
+            for (const auto& [state, transact_list]: transactions_by_state)
             {
-                if (!validate_list_against_properties(iter->second, user_cursor, card_cursor, merchant_cursor,
+                if (!validate_list_against_properties(transact_list, user_cursor, card_cursor,
                         options.properties))
-                    iter = transactions_by_city.erase(iter);
-                else
-                    ++iter;
+                    transactions_by_state.erase(state);
             }
         }
 
         if (!count_only)
         {
-            for (auto& pair : transactions_by_city)
+            for (auto& pair : transactions_by_state)
             {
                 std::sort(std::execution::par, pair.second.begin(), pair.second.end(), sort_by_amount{ options.order });
-                if (options.count > 0 && options.count < pair.second.size())
+                if (options.count > 0)
                     pair.second.erase(pair.second.begin() + options.count, pair.second.end());
             }
         }
         else
         {
-            count_set<std::string> s(transactions_by_city.begin(), transactions_by_city.end(), sort_by_count<std::string>{options.order});
+            count_set<std::string> s(transactions_by_state.begin(),
+                    transactions_by_state.end(), sort_by_count<std::string>{options.order});
             if (options.count > 0)
             {
                 auto iter = s.begin();
-                for (int i = 0; i < options.count && i < s.size(); ++i)
+                for (int i = 0; i < options.count; ++i)
                     iter++;
                 s.erase(iter, s.end());
             }
 
-            XmlBuilder b;
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+
+            auto& b = *writer;
             b
                 .add_signature()
                 .add_child("Data")
-                    .add_child("Counts", {
-                            {"order", options.order == Order::Ascending ? "ascending" : "descending"},
-                            {"groupedBy", "cities"},
-                            {"strict", options.strict ? "true" : "false"}
+                    .begin_array("Counts", {
+                        {"order", options.order == Order::Ascending ? "ascending" : "descending"},
+                        {"groupedBy", "states"},
+                        {"strict", options.strict ? "true" : "false"}
                     });
-            for (const auto& [city, transact_list] : s)
-                b.add_string("Count", {{"city", city}}, std::to_string(transact_list.size()));
+            for (const auto& [state, transact_list] : s)
+                b.add_string("Count", {{"state", state}}, std::to_string(transact_list.size()));
 
-            std::string xml = b.serialize(options.pretty);
-            if (options.selectors.empty() && options.properties.empty())
-            {
-                std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-                out.write(xml.c_str(), (std::streamsize)xml.size());
-                out.close();
-            }
-            return std::make_shared<string_response>(xml, 200, "application/xml");
+            std::string xml = b.serialize();
+            return compression::make_response(std::move(xml), 200, DocumentWriter::content_type(options.format), store_key);
         }
 
-        XmlBuilder::attribute_map attributes {
+        auto results = std::make_shared<ResultSet>();
+        results->element = "Results";
+        results->attributes = {
             {"order", options.order == Order::Descending ? "descending" : "ascending"},
             {"verbose", options.verbose ? "true" : "false"},
             {"strict", options.strict ? "true" : "false"},
-            {"groupedBy", "city"}
+            {"groupedBy", "state"}
         };
+        if (options.count > 0)
+            results->attributes.emplace("count", std::to_string(options.count));
+        results->fields = (uint16_t)(options.fields & ~(uint16_t)ProjectedField::Location);
+        results->verbose = options.verbose;
+        for (auto& [state, transact_list] : transactions_by_state)
+            results->groups.push_back({ state, {}, std::move(transact_list), "state" });
+
+        materialize_results("states", options, *results);
+        auto response = respond_with_results(std::move(results), options, env, store_key, user_cursor, card_cursor);
+
+        user_cursor.close();
+        card_cursor.close();
+        rtxn.abort();
+
+        return response;
+    }
+
+    /**
+     * Returns a single page of transactions, in the same order as an unpaginated
+     * query. Each page resumes where the previous one stopped in the amount
+     * index, so its cost is proportional to the page size rather than to the
+     * size of the whole result.
+     */
+    const Ref<http_response> process_transactions_page(TransactionQueryOptions& options, lmdb::env& env)
+    {
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto user_dbi = lmdb::dbi::open(rtxn, "users");
+        auto card_dbi = lmdb::dbi::open(rtxn, "cards");
+        auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
+        auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
+
+        read_transactions(rtxn);
+
+        auto query = query_fingerprint(options);
+        PageCursor cursor { dataset_version, query, 0, 0, (uint32_t)options.limit, options.order };
+        if (!options.cursor.empty())
+        {
+            auto decoded = PageCursor::decode(options.cursor);
+            if (!decoded.has_value())
+                return util::make_error("\"cursor\" is not a valid continuation token!", 400, options.format);
+            if (decoded->version != dataset_version)
+                return util::make_error("The dataset has changed since this cursor was issued, please start over without a cursor!", 410, options.format);
+            if (decoded->query != query || decoded->order != options.order)
+                return util::make_error("\"cursor\" belongs to a different query!", 400, options.format);
+
+            cursor = *decoded;
+            if (options.limit > 0)
+                cursor.limit = (uint32_t)options.limit;
+        }
+
+        size_t limit = cursor.limit;
+        if (options.count > 0)
+            limit = std::min(limit, (size_t)options.count - std::min<size_t>(cursor.returned, (size_t)options.count));
+
+        const auto& index = transactions_by_amount();
+        TransactionRefList page;
+        page.reserve(limit);
+
+        auto position = cursor.position;
+        for (; position < index.size() && page.size() < limit; ++position)
+        {
+            auto idx = options.order == Order::Descending ? index[index.size() - 1 - position] : index[position];
+            const auto& item = transactions[idx];
+            try
+            {
+                if (should_skip_transaction(item, user_cursor, card_cursor, options.strict, options.plan))
+                    continue;
+                page.push_back(&item);
+            }
+            catch (std::exception& ex)
+            {
+                return util::make_error(ex.what(), 400, options.format);
+            }
+        }
 
+        cursor.position = position;
+        cursor.returned += page.size();
+
+        DocumentWriter::attribute_map attributes {
+                {"order", options.order == Order::Descending ? "descending" : "ascending"},
+                {"verbose", options.verbose ? "true" : "false"},
+                {"strict", options.strict ? "true" : "false"},
+                {"limit", std::to_string(cursor.limit)}
+        };
         if (options.count > 0)
             attributes.emplace("count", std::to_string(options.count));
+        if (position < index.size() && (options.count <= 0 || cursor.returned < (size_t)options.count))
+            attributes.emplace("next", cursor.encode());
 
-        XmlBuilder builder;
+        auto writer = DocumentWriter::create(options.format, options.pretty);
+        auto& builder = *writer;
         builder
             .add_signature()
             .add_child("Data")
-                .add_iterator("Results", attributes, transactions_by_city.begin(), transactions_by_city.end(), [&, &verbose = options.verbose](XmlBuilder& b, const auto& pair) {
-                    auto& [city, transact_list] = pair;
-                    b.add_child(city);
-                    b.add_array("Transactions", transact_list, [&](XmlBuilder& b, models::Transaction const* t) {
-                        b.add_child("Transaction", {{"fraud", t->is_fraud ? "true" : "false"}});
-                        serialize_amount(b, t->amount);
-                        if (verbose)
-                            serialize_user_card(b, t->user_id, t->card_id, user_cursor, card_cursor);
-                        else
-                            serialize_user_card(b, t->user_id, t->card_id);
-                        serialize_date(b, t->time);
-                        serialize_transaction_type(b, t->type);
-                        if (verbose)
-                            serialize_merchant(b, t->merchant_id, merchant_cursor);
-                        else
-                            serialize_merchant(b, t->merchant_id, t->mcc);
-                        if (!t->errors.empty())
-                        {
-                            b.add_array("Errors", t->errors, [](XmlBuilder& b, const auto& s) {
-                                b.add_string("Error", s);
-                            });
-                        }
-                        b.step_up();
-                    });
-                    b.step_up();
+                .add_iterator("Transactions", attributes, page.begin(), page.end(), [&, &verbose = options.verbose](DocumentWriter& b, models::Transaction const* t) {
+                    serialize_transaction(b, t, options.fields, verbose, user_cursor, card_cursor);
                 });
 
         user_cursor.close();
         card_cursor.close();
-        merchant_cursor.close();
         rtxn.abort();
 
-        std::string xml = builder.serialize(options.pretty);
-
-        if (options.selectors.empty() && options.properties.empty())
-        {
-            std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-            out.write(xml.c_str(), (std::streamsize)xml.size());
-            out.close();
-        }
-        return std::make_shared<string_response>(xml, 200, "application/xml");
+        return compression::make_response(builder.serialize(), 200, DocumentWriter::content_type(options.format));
     }
 
-    const Ref<http_response> process_months(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    const Ref<http_response> process_transactions(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
     {
-        namespace fs = std::filesystem;
-
-        constexpr const char* months[12] {
-            "January",
-            "February",
-            "March",
-            "April",
-            "May",
-            "June",
-            "July",
-            "August",
-            "September",
-            "October",
-            "November",
-            "December"
-        };
+        if (!count_only && (options.limit > 0 || !options.cursor.empty()))
+            return process_transactions_page(options, env);
 
-        if (!fs::exists("cache"))
-            fs::create_directory("cache");
-
-        fs::path cache_file;
-        if (options.selectors.empty() && options.properties.empty())
+        std::string store_key;
+        if (options.selectors.empty())
         {
-            std::stringstream ss_name;
-            ss_name << "months";
-            if (!count_only && options.count > 0)
-                ss_name << "_" << options.count;
-            if (!count_only)
-                ss_name << "_" << (options.order == Order::Descending ? "descending" : "ascending");
-            if (options.verbose && !count_only)
-                ss_name << "_verbose";
-            if (options.strict)
-                ss_name << "_strict";
-            if (options.pretty)
-                ss_name << "_pretty";
-            if (count_only)
-                ss_name << "_count";
-            if (XmlBuilder::can_sign())
-                ss_name << "_signed";
-            ss_name << ".xml";
-            cache_file = fs::path("cache") / ss_name.str();
-
-            if (fs::exists(cache_file))
-                return std::make_shared<httpserver::file_response>(cache_file.string(), 200, "application/xml");
+            store_key = store_key_for("transactions", options, count_only);
+
+            if (auto stored = find_stored(store_key, options))
+                return stored;
         }
 
-        std::map<int, TransactionRefList> transactions_by_month;
+        TransactionRefList transact_list;
 
         auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
         auto user_dbi = lmdb::dbi::open(rtxn, "users");
         auto card_dbi = lmdb::dbi::open(rtxn, "cards");
-        auto merchant_dbi = lmdb::dbi::open(rtxn, "merchants");
         auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
         auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
-        auto merchant_cursor = lmdb::cursor::open(rtxn, merchant_dbi);
 
-        read_transactions();
+        read_transactions(rtxn);
+
+        if (!count_only)
+        {
+            if (auto derived = derive_results("transactions", options))
+                return respond_with_results(std::move(derived), options, env, store_key, user_cursor, card_cursor);
+        }
 
         for (const auto& item : transactions)
         {
             try
             {
-                if (should_skip_transaction(item, user_cursor, card_cursor, merchant_cursor, options.strict, options.selectors))
+                if (should_skip_transaction(item, user_cursor, card_cursor, options.strict, options.plan))
                     continue;
-
-                struct tm* ptm = gmtime(&item.time);
-                auto month = ptm->tm_mon;
-
-                if (!transactions_by_month.count(month))
-                    transactions_by_month.emplace(month, TransactionRefList {});
-
-                transactions_by_month[month].push_back(&item);
+                transact_list.push_back(&item);
             }
             catch (std::exception& ex)
             {
-                return util::make_xml_error(ex.what(), 400);
+                return util::make_error(ex.what(), 400, options.format);
             }
         }
 
-        if (!count_only)
-        {
-            for (auto& pair : transactions_by_month)
-            {
-                std::sort(std::execution::par, pair.second.begin(), pair.second.end(), sort_by_amount{ options.order });
-                if (options.count > 0)
-                    pair.second.erase(pair.second.begin() + options.count, pair.second.end());
-            }
-        }
-        else
-        {
-            count_set<int> s(transactions_by_month.begin(),
-                    transactions_by_month.end(), sort_by_count<int>{options.order});
-            if (options.count > 0)
-            {
-                auto iter = s.begin();
-                for (int i = 0; i < options.count; ++i)
-                    iter++;
-                s.erase(iter, s.end());
-            }
+        if (!count_only) std::sort(std::execution::par, transact_list.begin(), transact_list.end(), sort_by_amount{options.order});
+        if (options.count > 0 && (size_t)options.count < transact_list.size()) transact_list.erase(transact_list.begin() + options.count, transact_list.end());
 
-            XmlBuilder b;
+        if (count_only)
+        {
+            auto writer = DocumentWriter::create(options.format, options.pretty);
+            auto& b = *writer;
             b
-                    .add_signature()
-                    .add_child("Data")
-                        .add_child("Counts", {
-                            {"order", options.order == Order::Ascending ? "ascending" : "descending"},
-                            {"groupedBy", "months"},
-                            {"strict", options.strict ? "true" : "false"}
-                        });
-            for (const auto& [month, transact_list] : s)
-                b.add_string("Count", {{"month", months[month]}}, std::to_string(transact_list.size()));
+                .add_signature()
+                .add_child("Data")
+                    .add_string("Count", {{"strict", options.strict ? "true" : "false"}}, std::to_string(transact_list.size()));
 
-            std::string xml = b.serialize(options.pretty);
-            if (options.selectors.empty() && options.properties.empty())
-            {
-                std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-                out.write(xml.c_str(), (std::streamsize)xml.size());
-                out.close();
-            }
-            return std::make_shared<string_response>(xml, 200, "application/xml");
+            std::string xml = b.serialize();
+            return compression::make_response(std::move(xml), 200, DocumentWriter::content_type(options.format), store_key);
         }
 
-        XmlBuilder::attribute_map attributes {
+        auto results = std::make_shared<ResultSet>();
+        results->element = "Transactions";
+        results->attributes = {
                 {"order", options.order == Order::Descending ? "descending" : "ascending"},
                 {"verbose", options.verbose ? "true" : "false"},
-                {"strict", options.strict ? "true" : "false"},
-                {"groupedBy", "month"}
+                {"strict", options.strict ? "true" : "false"}
         };
         if (options.count > 0)
-            attributes.emplace("count", std::to_string(options.count));
+            results->attributes.emplace("count", std::to_string(options.count));
+        results->fields = options.fields;
+        results->verbose = options.verbose;
+        results->groups.push_back({ std::string{}, {}, std::move(transact_list), std::string{} });
 
-        XmlBuilder builder;
-        builder
-                .add_signature()
-                .add_child("Data")
-                .add_iterator("Results", attributes, transactions_by_month.begin(), transactions_by_month.end(), [&, &verbose = options.verbose](XmlBuilder& b, const auto& pair) {
-                    auto& [month, transact_list] = pair;
-                    b.add_child(months[month]);
-                    b.add_array("Transactions", transact_list, [&](XmlBuilder& b, models::Transaction const* t) {
-                        b.add_child("Transaction", {{"fraud", t->is_fraud ? "true" : "false"}});
-                        serialize_amount(b, t->amount);
-                        if (verbose)
-                            serialize_user_card(b, t->user_id, t->card_id, user_cursor, card_cursor);
-                        else
-                            serialize_user_card(b, t->user_id, t->card_id);
-                        serialize_date(b, t->time);
-                        serialize_transaction_type(b, t->type);
-                        if (verbose)
-                            serialize_merchant(b, t->merchant_id, merchant_cursor);
-                        else
-                            serialize_merchant(b, t->merchant_id, t->mcc);
-                        if (!t->errors.empty())
-                        {
-                            b.add_array("Errors", t->errors, [](XmlBuilder& b, const auto& s) {
-                                b.add_string("Error", s);
-                            });
-                        }
-                        b.step_up();
-                    });
-                    b.step_up();
-                });
+        materialize_results("transactions", options, *results);
+        auto response = respond_with_results(std::move(results), options, env, store_key, user_cursor, card_cursor);
 
         user_cursor.close();
         card_cursor.close();
-        merchant_cursor.close();
         rtxn.abort();
 
-        std::string xml = builder.serialize(options.pretty);
+        return response;
+    }
 
-        if (options.selectors.empty() && options.properties.empty())
-        {
-            std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-            out.write(xml.c_str(), (std::streamsize)xml.size());
-            out.close();
-        }
-        return std::make_shared<string_response>(xml, 200, "application/xml");
+    std::string render_models(OutputFormat format, bool pretty)
+    {
+        auto writer = DocumentWriter::create(format, pretty);
+
+        auto& b = *writer;
+        b
+            .add_signature()
+            .add_array("Models", {
+                "transactions",
+                "users",
+                "cards",
+                "merchants",
+                "cities",
+                "states",
+                "zipcodes"
+            }, [](DocumentWriter& b, const std::string_view& model) { b.add_string("Model", model); });
+
+        return b.serialize();
     }
 
-    const Ref<http_response> process_states(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    /**
+     * @returns The name of the model a query is for, or an empty string if
+     *          there's no such model
+     */
+    std::string_view model_name(const std::string& query_type)
     {
-        namespace fs = std::filesystem;
+        if (query_type == "transaction" || query_type == "transactions") return "transactions";
+        else if (query_type == "model" || query_type == "models") return "models";
+        else if (query_type == "state" || query_type == "states") return "states";
+        else if (query_type == "month" || query_type == "months") return "months";
+        else if (query_type == "city" || query_type == "cities") return "cities";
+        else if (query_type == "merchant" || query_type == "merchants") return "merchants";
+        else if (query_type == "unique_merchant" || query_type == "unique_merchants") return "unique_merchants";
+        else if (query_type == "insuff_bal_percentage") return "insuff_bal_percentage";
+        else if (query_type == "recurring_transactions") return "recurring_transactions";
+        return {};
+    }
+
+    Ref<http_response> run_query(const std::string_view& model, TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    {
+        if (model == "transactions")
+            return process_transactions(options, env, count_only);
+        else if (model == "states")
+            return process_states(options, env, count_only);
+        else if (model == "months")
+            return process_months(options, env, count_only);
+        else if (model == "cities")
+            return process_cities(options, env, count_only);
+        else if (model == "merchants")
+            return merchant_processor(options, env, count_only).run();
+        else if (model == "unique_merchants")
+            return unique_merchant_processor(options, env, count_only).run();
+        else if (model == "insuff_bal_percentage")
+            return insuff_bal_percentage(options, env, count_only).run();
+        else if (model == "recurring_transactions")
+            return recurring_transactions(options, env, count_only).run();
+
+        return util::make_error("Not yet implemented!", 500, options.format);
+    }
+
+    /**
+     * @returns The body a response sends, or null if it's streamed
+     */
+    Ref<body_response> body_of(const Ref<http_response>& response)
+    {
+        if (auto body = std::dynamic_pointer_cast<body_response>(response))
+            return body;
+        if (auto compressible = std::dynamic_pointer_cast<compression::compressible_response>(response))
+            return compressible->body();
+        return nullptr;
+    }
 
-        if (!fs::exists("cache"))
-            fs::create_directory("cache");
+    /**
+     * Tags a response with the entity tag of the exact bytes it sends and lets
+     * them be fetched in ranges. Streamed responses can't be tagged, their
+     * bytes aren't known until they've been sent.
+     *
+     * @returns The tag, or an empty string if the response wasn't tagged
+     */
+    std::string tag(const Ref<http_response>& response)
+    {
+        auto body = body_of(response);
+        if (!body)
+            return {};
+
+        auto checksum = body->checksum();
+        auto etag = util::entity_tag(body->size(), checksum ? *checksum : util::checksum(body->body()));
+        response->with_header("ETag", etag);
+        response->with_header("Accept-Ranges", "bytes");
+        return etag;
+    }
 
-        fs::path cache_file;
-        if (options.selectors.empty() && options.properties.empty())
+    /**
+     * Encodes a query's response the way the client asked for, tags it, and
+     * keeps it in the result cache. Streamed responses add themselves once
+     * they're sent, and responses sent from the cache store are left to it,
+     * since they hold on to one of its read transactions.
+     */
+    Ref<http_response> remember(const TransactionQueryOptions& options, const Ref<http_response>& response)
+    {
+        auto compressible = std::dynamic_pointer_cast<compression::compressible_response>(response);
+        if (!compressible || compressible->get_response_code() != 200)
+            return compression::encode(options.encoding, response);
+
+        auto encoded = compression::encode(options.encoding, response);
+        // A stale body isn't current, and it's replaced once it's refreshed
+        if (compressible->stale())
+            return encoded;
+
+        auto etag = tag(encoded);
+        if (compressible->stored())
+            return encoded;
+
+        ResultCache::Entry entry { {}, nullptr, DocumentWriter::content_type(options.format), compression::Encoding::Identity, etag };
+        if (encoded == response)
         {
-            std::stringstream ss_name;
-            ss_name << "states";
-            if (!count_only && options.count > 0)
-                ss_name << "_" << options.count;
-            if (!count_only)
-                ss_name << "_" << (options.order == Order::Descending ? "descending" : "ascending");
-            if (options.verbose && !count_only)
-                ss_name << "_verbose";
-            if (options.strict)
-                ss_name << "_strict";
-            if (options.pretty)
-                ss_name << "_pretty";
-            if (count_only)
-                ss_name << "_count";
-            if (XmlBuilder::can_sign())
-                ss_name << "_signed";
-            ss_name << ".xml";
-            cache_file = fs::path("cache") / ss_name.str();
-
-            if (fs::exists(cache_file))
-                return std::make_shared<httpserver::file_response>(cache_file.string(), 200, "application/xml");
+            entry.body = compressible->body()->body();
+            entry.owner = compressible->body()->owner();
+        }
+        else if (auto body = std::dynamic_pointer_cast<body_response>(encoded))
+        {
+            entry.body = body->body();
+            entry.owner = body->owner();
+            entry.encoding = options.encoding;
         }
+        result_cache.insert(options.cache_key, std::move(entry));
+        return encoded;
+    }
 
-        std::map<std::string, TransactionRefList> transactions_by_state;
+    static std::mutex flights_mutex;
+    static std::unordered_map<std::string, std::shared_future<Ref<http_response>>> flights;
+
+    /**
+     * Computes a query's response, unless an identical query is already being
+     * computed, in which case its response is shared instead. Every response
+     * a query can produce can be sent to more than one request.
+     *
+     * @param key The query's result cache key
+     */
+    template<typename Func>
+    Ref<http_response> run_once(const std::string& key, Func compute)
+    {
+        std::promise<Ref<http_response>> promise;
+        {
+            std::unique_lock lock(flights_mutex);
+            auto it = flights.find(key);
+            if (it != flights.end())
+            {
+                auto flight = it->second;
+                lock.unlock();
+                return flight.get();
+            }
+            flights.emplace(key, promise.get_future().share());
+        }
 
-        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-        auto user_dbi = lmdb::dbi::open(rtxn, "users");
-        auto card_dbi = lmdb::dbi::open(rtxn, "cards");
-        auto merchant_dbi = lmdb::dbi::open(rtxn, "merchants");
-        auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
-        auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
-        auto merchant_cursor = lmdb::cursor::open(rtxn, merchant_dbi);
+        auto land = [&key] {
+            std::lock_guard lock(flights_mutex);
+            flights.erase(key);
+        };
+
+        try
+        {
+            auto response = compute();
+            promise.set_value(response);
+            land();
+            return response;
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+            land();
+            throw;
+        }
+    }
 
-        read_transactions();
+    /**
+     * Reads a query's options from a JSON body that has already been validated
+     * against /query/schema.json.
+     *
+     * @returns Why the options are invalid, or an empty string if they aren't
+     */
+    std::string options_from_json(const nlohmann::json& j, TransactionQueryOptions& options)
+    {
+        if (j.contains("format"))
+        {
+            auto requested = j["format"].get<std::string>();
+            if (requested == "json")
+                options.format = OutputFormat::Json;
+            else if (requested == "arrow")
+                options.format = OutputFormat::Arrow;
+            else
+                options.format = OutputFormat::Xml;
+        }
+        if (j.contains("count"))
+            options.count = j["count"].get<int>();
+        if (j.contains("limit"))
+        {
+            // A limit of 0 or less would silently turn into an unpaged result
+            options.limit = j["limit"].get<int>();
+            if (options.limit <= 0)
+                return "\"limit\" must be greater than 0!";
+        }
+        if (j.contains("cursor"))
+            options.cursor = j["cursor"].get<std::string>();
+        if (j.contains("order"))
+            options.order = j["order"].get<std::string>() == "ascending" ? Order::Ascending : Order::Descending;
+        if (j.contains("verbose"))
+            options.verbose = j["verbose"].get<bool>();
+        if (j.contains("projection"))
+        {
+            auto [fields, invalid] { parse_projection(j["projection"].get<std::vector<std::string>>()) };
+            if (!invalid.empty())
+                return "\"projection\" contains an invalid field: "s + invalid;
+            if (fields != 0)
+                options.fields = fields;
+        }
+        if (j.contains("strict"))
+            options.strict = j["strict"].get<bool>();
+        if (j.contains("pretty"))
+            options.pretty = j["pretty"].get<bool>();
+        if (j.contains("selectors"))
+        {
+            auto selector_arr = j["selectors"].get<nlohmann::json::array_t>();
+            for (size_t i = 0; i < selector_arr.size(); ++i)
+            {
+                auto& selector = selector_arr[i];
 
-        for (const auto& item : transactions)
+                auto field = transaction_field_from_json(selector["field"]);
+                auto selectorType = selector_type_from_string(selector["type"].get<std::string>());
+                std::vector<std::string> values;
+                if (selector["value"].is_array())
+                {
+                    for (const auto& value : selector["value"])
+                        values.emplace_back(value.get<std::string>());
+                }
+                else if (selector["value"].is_object())
+                {
+                    // TODO(Jordan): Implement
+                }
+                else
+                {
+                    values.emplace_back(selector["value"].get<std::string>());
+                }
+                auto qs = QuerySelector { field, selectorType, values };
+                auto [valid, error] { validate_selector(qs) };
+                if (!valid)
+                    return "An error occurred while validating selectors["s + std::to_string(i) + "]: "s + error;
+                options.selectors.push_back(qs);
+            }
+        }
+        if (j.contains("properties"))
         {
-            try
+            auto property_arr = j["properties"].get<nlohmann::json::array_t>();
+            for (size_t i = 0; i < property_arr.size(); ++i)
             {
-                if (should_skip_transaction(item, user_cursor, card_cursor, merchant_cursor, options.strict, options.selectors))
-                    continue;
+                auto& property = property_arr[i];
 
-                if (item.merchant_state.empty())
-                    continue;
+                auto field = transaction_field_from_json(property["field"]);
+                auto condition = property_condition_from_string(property["condition"].get<std::string>());
+                auto selectorType = selector_type_from_string(property["type"].get<std::string>());
+                std::vector<std::string> values;
+                if (property["value"].is_array())
+                {
+                    for (const auto& value : property["value"])
+                        values.emplace_back(value.get<std::string>());
+                }
+                else if (property["value"].is_object())
+                {
+                    // TODO(Jordan): Implement
+                }
+                else
+                {
+                    values.emplace_back(property["value"].get<std::string>());
+                }
+                auto qp = QueryProperty { condition, { field, selectorType, values } };
+                auto [valid, error] { validate_selector(qp.selector) };
+                if (!valid)
+                    return "An error occurred while validating properties["s + std::to_string(i) + "]: "s + error;
+                options.properties.push_back(qp);
+            }
+        }
 
-                // Not a state abbreviation, must be a country
-                if (item.merchant_state.size() > 2)
-                    continue;
+        return std::string{};
+    }
 
-                if (!transactions_by_state.count(item.merchant_state))
-                    transactions_by_state.emplace(item.merchant_state, TransactionRefList{});
+    // Background jobs yield the CPU to requests
+    constexpr int BACKGROUND_NICENESS = 10;
 
-                transactions_by_state[item.merchant_state].push_back(&item);
-            }
-            catch (std::exception& ex)
-            {
-                return util::make_xml_error(ex.what(), 400);
-            }
+    /**
+     * Runs jobs one at a time on a low priority thread of its own, skipping
+     * any that are already waiting under the same key.
+     */
+    class BackgroundQueue
+    {
+    public:
+        ~BackgroundQueue()
+        {
+            stop();
         }
 
-        if (!options.properties.empty())
+        void schedule(const std::string& key, std::function<void()> job)
         {
-            for (const auto& [state, transact_list]: transactions_by_state)
-            {
-                if (!validate_list_against_properties(transact_list, user_cursor, card_cursor, merchant_cursor,
-                        options.properties))
-                    transactions_by_state.erase(state);
-            }
+            std::lock_guard lock(p_mutex);
+            if (p_stopping || !p_pending.insert(key).second)
+                return;
+
+            p_jobs.emplace_back(key, std::move(job));
+            if (!p_worker.joinable())
+                p_worker = std::thread([this] { run(); });
+            p_cv.notify_one();
         }
 
-        if (!count_only)
+        /**
+         * Drops the jobs that haven't started and waits for the one that has.
+         */
+        void stop()
         {
-            for (auto& pair : transactions_by_state)
             {
-                std::sort(std::execution::par, pair.second.begin(), pair.second.end(), sort_by_amount{ options.order });
-                if (options.count > 0)
-                    pair.second.erase(pair.second.begin() + options.count, pair.second.end());
+                std::lock_guard lock(p_mutex);
+                p_stopping = true;
+                p_jobs.clear();
             }
+            p_cv.notify_one();
+            if (p_worker.joinable())
+                p_worker.join();
         }
-        else
+
+    private:
+        void run()
         {
-            count_set<std::string> s(transactions_by_state.begin(),
-                    transactions_by_state.end(), sort_by_count<std::string>{options.order});
-            if (options.count > 0)
+            // NOTE: Linux gives every thread a niceness of its own.
+            setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), BACKGROUND_NICENESS);
+
+            while (true)
             {
-                auto iter = s.begin();
-                for (int i = 0; i < options.count; ++i)
-                    iter++;
-                s.erase(iter, s.end());
-            }
+                std::pair<std::string, std::function<void()>> job;
+                {
+                    std::unique_lock lock(p_mutex);
+                    p_cv.wait(lock, [this] { return p_stopping || !p_jobs.empty(); });
+                    if (p_stopping)
+                        return;
+                    job = std::move(p_jobs.front());
+                    p_jobs.pop_front();
+                }
 
-            XmlBuilder b;
-            b
-                .add_signature()
-                .add_child("Data")
-                    .add_child("Counts", {
-                        {"order", options.order == Order::Ascending ? "ascending" : "descending"},
-                        {"groupedBy", "states"},
-                        {"strict", options.strict ? "true" : "false"}
-                    });
-            for (const auto& [state, transact_list] : s)
-                b.add_string("Count", {{"state", state}}, std::to_string(transact_list.size()));
+                try
+                {
+                    job.second();
+                }
+                catch (std::exception& ex)
+                {
+                    spdlog::error("Background job \"{}\" failed: {}", job.first, ex.what());
+                }
 
-            std::string xml = b.serialize(options.pretty);
-            if (options.selectors.empty() && options.properties.empty())
-            {
-                std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-                out.write(xml.c_str(), (std::streamsize)xml.size());
-                out.close();
+                std::lock_guard lock(p_mutex);
+                p_pending.erase(job.first);
             }
-            return std::make_shared<string_response>(xml, 200, "application/xml");
         }
 
-        XmlBuilder::attribute_map attributes {
-                {"order", options.order == Order::Descending ? "descending" : "ascending"},
-                {"verbose", options.verbose ? "true" : "false"},
-                {"strict", options.strict ? "true" : "false"},
-                {"groupedBy", "state"}
-        };
-        if (options.count > 0)
-            attributes.emplace("count", std::to_string(options.count));
+        std::mutex p_mutex;
+        std::condition_variable p_cv;
+        std::deque<std::pair<std::string, std::function<void()>>> p_jobs;
+        std::unordered_set<std::string> p_pending;
+        std::thread p_worker;
+        bool p_stopping = false;
+    };
 
-        XmlBuilder builder;
-        builder
-            .add_signature()
-            .add_child("Data")
-                .add_iterator("Results", attributes, transactions_by_state.begin(), transactions_by_state.end(), [&, &verbose = options.verbose](XmlBuilder& b, const auto& pair) {
-                    auto& [state, transact_list] = pair;
-                    b.add_child(state);
-                    b.add_array("Transactions", transact_list, [&](XmlBuilder& b, models::Transaction const* t) {
-                        b.add_child("Transaction", {{"fraud", t->is_fraud ? "true" : "false"}});
-                        serialize_amount(b, t->amount);
-                        if (verbose)
-                            serialize_user_card(b, t->user_id, t->card_id, user_cursor, card_cursor);
-                        else
-                            serialize_user_card(b, t->user_id, t->card_id);
-                        serialize_date(b, t->time);
-                        serialize_transaction_type(b, t->type);
-                        if (verbose)
-                            serialize_merchant(b, t->merchant_id, merchant_cursor);
-                        else
-                            serialize_merchant(b, t->merchant_id, t->mcc);
-                        if (!t->errors.empty())
-                        {
-                            b.add_array("Errors", t->errors, [](XmlBuilder& b, const auto& s) {
-                                b.add_string("Error", s);
-                            });
-                        }
-                        b.step_up();
-                    });
-                    b.step_up();
-                });
+    static BackgroundQueue background_jobs;
 
-        user_cursor.close();
-        card_cursor.close();
-        merchant_cursor.close();
-        rtxn.abort();
+    /**
+     * Recomputes a result that was sent from the cache store but was computed
+     * from an older dataset. Until it's replaced the old one keeps being sent.
+     */
+    void refresh_if_stale(const std::string_view& model, const TransactionQueryOptions& options, const Ref<lmdb::env>& env,
+                          bool count_only, const Ref<http_response>& response)
+    {
+        auto stored = std::dynamic_pointer_cast<compression::compressible_response>(response);
+        if (!stored || !stored->stale())
+            return;
 
-        std::string xml = builder.serialize(options.pretty);
+        auto refreshed = options;
+        refreshed.refresh = true;
+        refreshed.cache_key.clear();
 
-        if (options.selectors.empty() && options.properties.empty())
-        {
-            std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-            out.write(xml.c_str(), (std::streamsize)xml.size());
-            out.close();
-        }
-        return std::make_shared<string_response>(xml, 200, "application/xml");
+        auto key = stored->store_key() + ";" + compression::name(options.encoding);
+        background_jobs.schedule(key, [model = std::string(model), refreshed, env, count_only]() mutable {
+            auto start = std::chrono::steady_clock::now();
+            auto response = run_query(model, refreshed, *env, count_only);
+
+            // Streamed results are only stored as they're sent, the encoded
+            // sibling is stored by encoding the result
+            if (auto stream = std::dynamic_pointer_cast<result_stream_response>(response))
+                stream->store();
+            else
+                compression::encode(refreshed.encoding, response);
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            spdlog::info("Refreshed a stale {} result in {}ms", model, elapsed.count());
+        });
     }
 
-    const Ref<http_response> process_transactions(TransactionQueryOptions& options, lmdb::env& env, bool count_only)
+    uint64_t dataset_fingerprint(lmdb::env& env)
     {
-        namespace fs = std::filesystem;
+        return fingerprint_dataset(env);
+    }
 
-        if (!fs::exists("cache"))
-            fs::create_directory("cache");
+    Ref<http_response> not_modified(const std::string& etag, const TransactionQueryOptions& options)
+    {
+        auto response = std::make_shared<body_response>(std::string{}, 304, DocumentWriter::content_type(options.format));
+        response->with_header("ETag", etag);
+        response->with_header("Vary", "Accept-Encoding");
+        return response;
+    }
 
-        fs::path cache_file;
-        if (options.selectors.empty())
+    /**
+     * Sends the part of a response the Range header asks for, so big results
+     * can be resumed or fetched in parallel. Ranges are of the encoded body,
+     * which is what the ETag identifies. Responses without one (stale or
+     * streamed ones) are sent whole, since a range of them can't be matched
+     * up with the rest.
+     */
+    Ref<http_response> ranged(const http_request& req, const Ref<http_response>& response)
+    {
+        auto header = req.get_header("Range");
+        if (header.empty() || response->get_response_code() != 200)
+            return response;
+
+        auto body = body_of(response);
+        if (!body)
+            return response;
+
+        // NOTE: get_header() would add the header if it's missing, and the
+        //       response may be shared with other requests.
+        const auto& headers = response->get_headers();
+        auto etag = headers.find("ETag");
+        if (etag == headers.end())
+            return response;
+
+        auto if_range = req.get_header("If-Range");
+        if (!if_range.empty() && etag->second != if_range)
+            return response;
+
+        auto range = util::parse_range(header, body->size());
+        if (!range)
+            return response;
+
+        Ref<body_response> partial;
+        if (range->length == 0)
         {
-            std::stringstream ss_name;
-            ss_name << "transactions";
-            if (!count_only && options.count > 0)
-                ss_name << "_" << options.count;
-            if (!count_only)
-                ss_name << "_" << (options.order == Order::Descending ? "descending" : "ascending");
-            if (options.verbose && !count_only)
-                ss_name << "_verbose";
-            if (options.strict)
-                ss_name << "_strict";
-            if (options.pretty)
-                ss_name << "_pretty";
-            if (count_only)
-                ss_name << "_count";
-            if (XmlBuilder::can_sign())
-                ss_name << "_signed";
-            // TODO(Jordan): Encode selectors into cache name
-            ss_name << ".xml";
-            cache_file = fs::path("cache") / ss_name.str();
-
-            // TODO(Jordan): Check if timestamp on file is newer than transactions.csv
-            if (fs::exists(cache_file))
-                return std::make_shared<httpserver::file_response>(cache_file.string(), 200, "application/xml");
+            partial = std::make_shared<body_response>(std::string{}, 416, "text/plain");
+            partial->with_header("Content-Range", "bytes */" + std::to_string(body->size()));
+            return partial;
         }
 
-        TransactionRefList transact_list;
+        partial = std::make_shared<body_response>(body->body().substr(range->offset, range->length), body->owner(), 206, "text/plain");
+        // Content-Type is one of the headers, along with the ETag and Content-Encoding
+        for (const auto& [name, value] : headers)
+            partial->with_header(name, value);
+        partial->with_header("Content-Range", "bytes " + std::to_string(range->offset) + "-" +
+                                              std::to_string(range->offset + range->length - 1) + "/" + std::to_string(body->size()));
+        return partial;
+    }
 
-        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-        auto user_dbi = lmdb::dbi::open(rtxn, "users");
-        auto card_dbi = lmdb::dbi::open(rtxn, "cards");
-        auto merchant_dbi = lmdb::dbi::open(rtxn, "merchants");
-        auto user_cursor = lmdb::cursor::open(rtxn, user_dbi);
-        auto card_cursor = lmdb::cursor::open(rtxn, card_dbi);
-        auto merchant_cursor = lmdb::cursor::open(rtxn, merchant_dbi);
+    /**
+     * Answers a query from the result cache, or computes it once for every
+     * request that asks for it at the same time. Cached responses are
+     * returned encoded and with an ETag.
+     */
+    Ref<http_response> answer(const std::string_view& model, TransactionQueryOptions& options, const Ref<lmdb::env>& env, bool count_only)
+    {
+        // Pages are cheap to compute already, so they're neither cached nor shared
+        if (options.limit > 0 || !options.cursor.empty())
+            return run_query(model, options, *env, count_only);
+
+        // NOTE: Until the first query has loaded the dataset there's no version
+        //       to key results by, those queries are still shared though.
+        bool versioned = processed;
+        auto key = result_cache_key(model, options, count_only);
+        if (versioned)
+        {
+            options.cache_key = key;
+            if (auto cached = result_cache.find(key))
+                return cached->response();
+        }
 
-        read_transactions();
+        return run_once(key, [&] {
+            auto response = run_query(model, options, *env, count_only);
+            refresh_if_stale(model, options, env, count_only, response);
 
-        for (const auto& item : transactions)
+            // Encoded here instead of by the resource, so the ETag ends up on what's sent
+            // NOTE: Tagged before it's shared, the response is never changed after that.
+            if (options.cache_key.empty())
+                return compression::encode(options.encoding, response);
+            return remember(options, response);
+        });
+    }
+
+    void prewarm(const std::filesystem::path& file, Ref<lmdb::env> env)
+    {
+        using clock = std::chrono::steady_clock;
+        auto milliseconds_since = [](clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+        };
+
+        nlohmann::json list;
+        nlohmann::json_schema::json_validator validator{};
+        try
         {
-            try
-            {
-                if (should_skip_transaction(item, user_cursor, card_cursor, merchant_cursor, options.strict, options.selectors))
-                    continue;
-                transact_list.push_back(&item);
-            }
-            catch (std::exception& ex)
-            {
-                return util::make_xml_error(ex.what(), 400);
-            }
+            std::ifstream in(file, std::ios::in);
+            list = nlohmann::json::parse(in);
+
+            std::ifstream schema("data/schema.json", std::ios::in);
+            nlohmann::json j;
+            schema >> j;
+            validator.set_root_schema(j);
+        }
+        catch (std::exception& ex)
+        {
+            spdlog::error("Unable to read the prewarm list at `{}`: {}", file.string(), ex.what());
+            return;
         }
 
-        if (!count_only) std::sort(std::execution::par, transact_list.begin(), transact_list.end(), sort_by_amount{options.order});
-        if (options.count > 0) transact_list.erase(transact_list.begin() + options.count, transact_list.end());
+        if (!list.is_array())
+        {
+            spdlog::error("The prewarm list at `{}` must be an array of queries!", file.string());
+            return;
+        }
 
-        if (count_only)
+        struct Progress
         {
-            XmlBuilder b;
-            b
-                .add_signature()
-                .add_child("Data")
-                    .add_string("Count", {{"strict", options.strict ? "true" : "false"}}, std::to_string(transact_list.size()));
+            clock::time_point start = clock::now();
+            std::atomic<size_t> scheduled = 0;
+            std::atomic<size_t> warmed = 0;
+        };
+        auto progress = std::make_shared<Progress>();
+
+        background_jobs.schedule("prewarm:dataset", [env, milliseconds_since] {
+            auto start = clock::now();
+            auto rtxn = lmdb::txn::begin(*env, nullptr, MDB_RDONLY);
+            read_transactions(rtxn);
+            rtxn.abort();
+            spdlog::info("Prewarm: loaded the dataset in {}ms", milliseconds_since(start));
+        });
 
-            std::string xml = b.serialize(options.pretty);
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            const auto& entry = list[i];
+            auto query = entry.value("query", std::string{});
+            std::transform(query.begin(), query.end(), query.begin(), ::tolower);
 
-            if (options.selectors.empty())
+            bool count_only = false;
+            auto slash = query.find('/');
+            if (slash != std::string::npos)
             {
-                std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-                out.write(xml.c_str(), (std::streamsize)xml.size());
-                out.close();
+                count_only = query.compare(slash, std::string::npos, "/count") == 0;
+                query.erase(slash);
             }
-            return std::make_shared<string_response>(xml, 200, "application/xml");
-        }
 
-        std::unordered_map<std::string, std::string> attributes {
-                {"order", options.order == Order::Descending ? "descending" : "ascending"},
-                {"verbose", options.verbose ? "true" : "false"},
-                {"strict", options.strict ? "true" : "false"}
-        };
-        if (options.count > 0)
-            attributes.emplace("count", std::to_string(options.count));
+            auto model = model_name(query);
+            TransactionQueryOptions options;
+            std::string error;
+            if (model.empty() || (slash != std::string::npos && !count_only))
+                error = "\"query\" must be {model}[/count]";
+            else if (model == "models")
+                error = "the model list is rendered at startup";
+            else if (entry.contains("options"))
+            {
+                try
+                {
+                    validator.validate(entry["options"]);
+                    error = options_from_json(entry["options"], options);
+                }
+                catch (std::exception& ex)
+                {
+                    error = ex.what();
+                }
+            }
 
-        XmlBuilder builder;
-        builder
-            .add_signature()
-            .add_child("Data")
-                .add_iterator("Transactions", attributes, transact_list.begin(), transact_list.end(), [&, &verbose = options.verbose](XmlBuilder& b, models::Transaction const* t) {
-                    b.add_child("Transaction", {{"fraud", t->is_fraud ? "true" : "false"}});
-                    serialize_amount(b, t->amount);
-                    if (verbose)
-                        serialize_user_card(b, t->user_id, t->card_id, user_cursor, card_cursor);
-                    else
-                        serialize_user_card(b, t->user_id, t->card_id);
-                    serialize_date(b, t->time);
-                    serialize_transaction_type(b, t->type);
-                    if (verbose)
-                        serialize_merchant(b, t->merchant_id, merchant_cursor);
-                    else
-                        serialize_merchant(b, t->merchant_id, t->mcc);
-                    serialize_location(b, t->merchant_city, t->merchant_state, t->zip);
-                    if (!t->errors.empty())
-                    {
-                        b.add_array("Errors", t->errors, [](XmlBuilder& b, const auto& s) {
-                            b.add_string("Error", s);
-                        });
-                    }
-                    b.step_up();
-                });
+            if (error.empty() && (options.limit > 0 || !options.cursor.empty()))
+                error = "pages aren't cached";
+            if (error.empty() && options.format == OutputFormat::Arrow && (count_only || model != "transactions"))
+                error = "Arrow output is only supported by /query/transactions";
+            if (!error.empty())
+            {
+                spdlog::warn("Prewarm: skipping query {}: {}", i, error);
+                continue;
+            }
+            options.plan = compile_query(options.selectors);
 
-        user_cursor.close();
-        card_cursor.close();
-        merchant_cursor.close();
-        rtxn.abort();
+            auto label = entry.value("query", std::string{});
+            auto encodings = entry.value("encodings", std::vector<std::string>{ "identity", "gzip" });
+            for (const auto& name : encodings)
+            {
+                // Encodings that are turned off or not built in are never negotiated
+                auto encoding = compression::from_name(name);
+                if (!encoding)
+                    continue;
 
-        std::string xml = builder.serialize(options.pretty);
+                auto warmed = options;
+                warmed.encoding = *encoding;
+                ++progress->scheduled;
 
-        if (options.selectors.empty())
-        {
-            std::ofstream out(cache_file, std::ios::out | std::ios::trunc);
-            out.write(xml.c_str(), (std::streamsize)xml.size());
-            out.close();
+                auto key = "prewarm:" + std::to_string(i) + ":" + name;
+                background_jobs.schedule(key, [model, warmed, env, count_only, label, progress, milliseconds_since]() mutable {
+                    auto start = clock::now();
+                    // Everything else is cached by answering it, streamed results are only cached as they're sent
+                    auto response = answer(model, warmed, env, count_only);
+                    if (auto stream = std::dynamic_pointer_cast<result_stream_response>(response))
+                        stream->store();
+
+                    ++progress->warmed;
+                    spdlog::info("Prewarm: {} ({}) took {}ms", label, compression::name(warmed.encoding), milliseconds_since(start));
+                });
+            }
         }
-        return std::make_shared<string_response>(xml, 200, "application/xml");
+
+        background_jobs.schedule("prewarm:done", [progress, milliseconds_since] {
+            spdlog::info("Prewarm: warmed {} of {} queries in {}ms",
+                         progress->warmed.load(), progress->scheduled.load(), milliseconds_since(progress->start));
+        });
     }
 
-    const Ref<http_response> get_models(TransactionQueryOptions& options)
+    void stop_background_work()
     {
-        namespace fs = std::filesystem;
-
-        if (!fs::exists("cache"))
-            fs::create_directory("cache");
-
-        std::string name = "cache/models";
-        if (options.pretty)
-            name += "_pretty";
-        name += ".xml";
-
-        if (fs::exists(name))
-            return std::make_shared<httpserver::file_response>(name, 200, "application/xml");
+        background_jobs.stop();
+    }
 
-        XmlBuilder b;
-        b
-            .add_signature()
-            .add_array("Models", {
-                "transactions",
-                "users",
-                "cards",
-                "merchants",
-                "cities",
-                "states",
-                "zipcodes"
-            }, [](XmlBuilder& b, const std::string_view& model) { b.add_string("Model", model); });
+    queries::queries(const Ref<Statistics>& stat_data, std::shared_ptr<lmdb::env> env) :
+        clean_resource("/query", true, stat_data), p_env(std::move(env))
+    {
+        auto schema = util::read_file("data/schema.json");
+        p_validator.set_root_schema(nlohmann::json::parse(schema));
+        p_schema = StaticDocument(std::move(schema), "application/json");
 
-        auto serialized = b.serialize(options.pretty);
-        std::ofstream cache_file(name, std::ios::out | std::ios::trunc);
-        cache_file.write(serialized.c_str(), (std::streamsize)serialized.size());
-        cache_file.close();
-        return std::make_shared<string_response>(serialized, 200, "application/xml");
+        for (auto format : { OutputFormat::Xml, OutputFormat::Json })
+        {
+            for (bool pretty : { false, true })
+                p_models[(size_t)format][pretty] = StaticDocument(render_models(format, pretty), DocumentWriter::content_type(format));
+        }
     }
 
     const Ref<http_response> queries::process(const http_request& req) try
     {
+        auto negotiated = util::negotiate_format(req);
+        if (!negotiated)
+            return util::make_xml_error("\"format\" must be either xml, json or arrow!", 400);
+        auto format = *negotiated;
+
         if (req.get_path_pieces().size() > 3)
-            return util::make_xml_error("Queries must be done in the following format: /query/{model}[/count]!", 400);
+            return util::make_error("Queries must be done in the following format: /query/{model}[/count]!", 400, format);
 
         bool count_only = false;
         if (req.get_path_pieces().size() == 3 && req.get_path_piece(2) != "count")
-            return util::make_xml_error("Queries must be done in the following format: /query/{model}[/count]!", 400);
+            return util::make_error("Queries must be done in the following format: /query/{model}[/count]!", 400, format);
         else if (req.get_path_pieces().size() == 3)
             count_only = true;
 
@@ -2102,10 +3946,12 @@ namespace resources::analytics
         std::transform(query_type.begin(), query_type.end(), query_type.begin(), ::tolower);
 
         if (query_type == "schema" || query_type == "schema.json")
-            return std::make_shared<httpserver::file_response>("data/schema.json", 200, "application/json");
+            return p_schema.response(compression::negotiate(req));
 
         auto args = req.get_args();
         TransactionQueryOptions options;
+        options.format = format;
+        options.encoding = compression::negotiate(req);
         std::string sort;
 
         auto type = req.get_header("Content-Type");
@@ -2122,84 +3968,18 @@ namespace resources::analytics
                 std::string err = ex.what();
                 auto idx = err.find(' ');
                 err.erase(0, idx + 1);
-                return util::make_xml_error("An error occurred while parsing json content: "s + err, 400);
+                return util::make_error("An error occurred while parsing json content: "s + err, 400, format);
             }
             catch (std::exception& ex)
             {
-                return util::make_xml_error("Failed to validate json against /query/schema.json: "s + ex.what(), 400);
-            }
-
-            if (j.contains("count"))
-                options.count = j["count"].get<int>();
-            if (j.contains("order"))
-                options.order = j["order"].get<std::string>() == "ascending" ? Order::Ascending : Order::Descending;
-            if (j.contains("verbose"))
-                options.verbose = j["verbose"].get<bool>();
-            if (j.contains("strict"))
-                options.strict = j["strict"].get<bool>();
-            if (j.contains("pretty"))
-                options.pretty = j["pretty"].get<bool>();
-            if (j.contains("selectors"))
-            {
-                auto selector_arr = j["selectors"].get<nlohmann::json::array_t>();
-                for (size_t i = 0; i < selector_arr.size(); ++i)
-                {
-                    auto& selector = selector_arr[i];
-
-                    auto field = transaction_field_from_json(selector["field"]);
-                    auto selectorType = selector_type_from_string(selector["type"].get<std::string>());
-                    std::vector<std::string> values;
-                    if (selector["value"].is_array())
-                    {
-                        for (const auto& value : selector["value"])
-                            values.emplace_back(value.get<std::string>());
-                    }
-                    else if (selector["value"].is_object())
-                    {
-                        // TODO(Jordan): Implement
-                    }
-                    else
-                    {
-                        values.emplace_back(selector["value"].get<std::string>());
-                    }
-                    auto qs = QuerySelector { field, selectorType, values };
-                    auto [valid, error] { validate_selector(qs) };
-                    if (!valid)
-                        return util::make_xml_error("An error occurred while validating selectors["s + std::to_string(i) + "]: "s + error, 400);
-                    options.selectors.push_back(qs);
-                }
+                return util::make_error("Failed to validate json against /query/schema.json: "s + ex.what(), 400, format);
             }
-            if (j.contains("properties"))
-            {
-                auto property_arr = j["properties"].get<nlohmann::json::array_t>();
-                for (size_t i = 0; i < property_arr.size(); ++i)
-                {
-                    auto& property = property_arr[i];
 
-                    auto field = transaction_field_from_json(property["field"]);
-                    auto condition = property_condition_from_string(property["condition"].get<std::string>());
-                    auto selectorType = selector_type_from_string(property["type"].get<std::string>());
-                    std::vector<std::string> values;
-                    if (property["value"].is_array())
-                    {
-                        for (const auto& value : property["value"])
-                            values.emplace_back(value.get<std::string>());
-                    }
-                    else if (property["value"].is_object())
-                    {
-                        // TODO(Jordan): Implement
-                    }
-                    else
-                    {
-                        values.emplace_back(property["value"].get<std::string>());
-                    }
-                    auto qp = QueryProperty { condition, { field, selectorType, values } };
-                    auto [valid, error] { validate_selector(qp.selector) };
-                    if (!valid)
-                        return util::make_xml_error("An error occurred while validating properties["s + std::to_string(i) + "]: "s + error, 400);
-                    options.properties.push_back(qp);
-                }
-            }
+            // Errors from here on are sent in the format the body asked for
+            auto error = options_from_json(j, options);
+            format = options.format;
+            if (!error.empty())
+                return util::make_error(error, 400, format);
         }
         else
         {
@@ -2207,14 +3987,29 @@ namespace resources::analytics
             {
                 auto [ec, value] { util::parse<int>(req.get_arg("count")) };
                 if (ec == std::errc::invalid_argument)
-                    return util::make_xml_error("\"count\" must be an integer!", 400);
+                    return util::make_error("\"count\" must be an integer!", 400, format);
                 else if (ec == std::errc::result_out_of_range)
-                    return util::make_xml_error("\"count\" is too large!", 400);
+                    return util::make_error("\"count\" is too large!", 400, format);
                 else if (value <= 0)
-                    return util::make_xml_error("\"count\" must be greater than 0!", 400);
+                    return util::make_error("\"count\" must be greater than 0!", 400, format);
                 options.count = value;
             }
 
+            if (args.find("limit") != args.end())
+            {
+                auto [ec, value] { util::parse<int>(req.get_arg("limit")) };
+                if (ec == std::errc::invalid_argument)
+                    return util::make_error("\"limit\" must be an integer!", 400, format);
+                else if (ec == std::errc::result_out_of_range)
+                    return util::make_error("\"limit\" is too large!", 400, format);
+                else if (value <= 0)
+                    return util::make_error("\"limit\" must be greater than 0!", 400, format);
+                options.limit = value;
+            }
+
+            if (args.find("cursor") != args.end())
+                options.cursor = req.get_arg("cursor");
+
             if (args.find("order") != args.end())
             {
                 std::string temp = req.get_arg("order");
@@ -2224,7 +4019,7 @@ namespace resources::analytics
                 else if (temp == "ascending" || temp == "asc" || temp == "ac")
                     options.order = Order::Ascending;
                 else
-                    return util::make_xml_error("\"order\" must be either ascending or descending!", 400);
+                    return util::make_error("\"order\" must be either ascending or descending!", 400, format);
             }
 
             if (args.find("verbose") != args.end())
@@ -2235,7 +4030,21 @@ namespace resources::analytics
                     options.verbose = true;
                 else if (temp == "false" || temp == "0" || temp == "off" || temp == "no" || temp == "n")
                     options.verbose = false;
-                else return util::make_xml_error("\"verbose\" must be a boolean value!", 400);
+                else return util::make_error("\"verbose\" must be a boolean value!", 400, format);
+            }
+
+            if (args.find("fields") != args.end())
+            {
+                std::vector<std::string> names;
+                std::stringstream ss{std::string{req.get_arg("fields")}};
+                for (std::string name; std::getline(ss, name, ',');)
+                    names.push_back(name);
+
+                auto [fields, invalid] { parse_projection(names) };
+                if (!invalid.empty())
+                    return util::make_error("\"fields\" contains an invalid field: "s + invalid, 400, format);
+                if (fields != 0)
+                    options.fields = fields;
             }
 
             if (args.find("strict") != args.end())
@@ -2246,7 +4055,7 @@ namespace resources::analytics
                     options.strict = true;
                 else if (temp == "false" || temp == "0" || temp == "off" || temp == "no" || temp == "n")
                     options.strict = false;
-                else return util::make_xml_error("\"strict\" must be a boolean value!", 400);
+                else return util::make_error("\"strict\" must be a boolean value!", 400, format);
             }
 
             if (args.find("pretty") != args.end())
@@ -2257,34 +4066,45 @@ namespace resources::analytics
                     options.pretty = true;
                 else if (temp == "false" || temp == "0" || temp == "off" || temp == "no" || temp == "n")
                     options.pretty = false;
-                else return util::make_xml_error("\"pretty\" must be a boolean value!", 400);
-            }
-        }
-
-        if (query_type == "transaction" || query_type == "transactions")
-            return process_transactions(options, *p_env, count_only);
-        else if (query_type == "model" || query_type == "models")
-            return get_models(options);
-        else if (query_type == "state" || query_type == "states")
-            return process_states(options, *p_env, count_only);
-        else if (query_type == "month" || query_type == "months")
-            return process_months(options, *p_env, count_only);
-        else if (query_type == "city" || query_type == "cities")
-            return process_cities(options, *p_env, count_only);
-        else if (query_type == "merchant" || query_type == "merchants")
-            return merchant_processor(options, *p_env, count_only).run();
-        else if (query_type == "unique_merchant" || query_type == "unique_merchants")
-            return unique_merchant_processor(options, *p_env, count_only).run();
-        else if (query_type == "insuff_bal_percentage")
-            return insuff_bal_percentage(options, *p_env, count_only).run();
-        else if (query_type == "recurring_transactions")
-            return recurring_transactions(options, *p_env, count_only).run();
-
-        return util::make_xml_error("Not yet implemented!", 500);
+                else return util::make_error("\"pretty\" must be a boolean value!", 400, format);
+            }
+        }
+
+        options.plan = compile_query(options.selectors);
+
+        auto model = model_name(query_type);
+
+        if ((options.limit > 0 || !options.cursor.empty()) && model != "transactions")
+            return util::make_error("\"limit\" and \"cursor\" are only supported by /query/transactions!", 400, format);
+
+        // Arrow is only worth it for the one result that's a plain table
+        if (options.format == OutputFormat::Arrow
+            && (count_only || options.limit > 0 || !options.cursor.empty() || model != "transactions"))
+            return util::make_error("Arrow output is only supported by /query/transactions without \"limit\" or \"cursor\"!", 400, options.format);
+
+        if (model.empty())
+            return util::make_error("Not yet implemented!", 500, format);
+        if (model == "models")
+            return p_models[(size_t)options.format][options.pretty].response(options.encoding);
+
+        auto response = answer(model, options, p_env, count_only);
+
+        // NOTE: Tags name the bytes that are sent, so they're only known once
+        //       there's a response, which is usually from the result cache.
+        auto if_none_match = req.get_header("If-None-Match");
+        if (!if_none_match.empty())
+        {
+            const auto& headers = response->get_headers();
+            auto etag = headers.find("ETag");
+            if (etag != headers.end() && util::etag_matches(if_none_match, etag->second))
+                return not_modified(etag->second, options);
+        }
+
+        return ranged(req, response);
     }
     catch (std::exception& e)
     {
         spdlog::error("An error occurred while processing a transaction query: {}", e.what());
-        return util::make_xml_error("An error occurred while processing your request, please notify a webadmin.", 500);
+        return util::make_error("An error occurred while processing your request, please notify a webadmin.", 500, util::negotiate_format(req).value_or(OutputFormat::Xml));
     }
 }
\ No newline at end of file
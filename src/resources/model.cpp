@@ -2,28 +2,33 @@
 
 #include <charconv>
 
-#include "helpers/xml_builder.hpp"
+#include "helpers/document_writer.hpp"
 #include "helpers/utilities.hpp"
+#include "helpers/body_response.hpp"
 
 #include "models.hpp"
 
 namespace resources::model
 {
-    using httpserver::string_response;
-
     const Ref<http_response> get_user::process(const http_request& req)
     {
         auto& path_pieces = req.get_path_pieces();
         auto& args = req.get_args();
-        XmlBuilder builder;
+
+        auto format = util::negotiate_format(req);
+        if (!format || *format == OutputFormat::Arrow)
+            return std::make_shared<body_response>("Format must be either xml or json!", 400, "text/plain");
+
+        auto writer = DocumentWriter::create(*format, false);
+        auto& builder = *writer;
 
         builder
                 .add_signature()
                 .add_child("Data")
-                .add_child("Users");
+                .begin_array("Users");
 
         if (path_pieces.size() > 2)
-            return std::make_shared<string_response>("Too many path elements! Expected /user/{id}/!", 400,
+            return std::make_shared<body_response>("Too many path elements! Expected /user/{id}/!", 400,
                     "text/plain");
 
         auto rtxn = lmdb::txn::begin(*p_env, nullptr, MDB_RDONLY);
@@ -70,7 +75,7 @@ namespace resources::model
         {
             std::string id = path_pieces.size() == 1 ? args.at("id") : path_pieces.at(1);
             if (!util::is_integer(id))
-                return std::make_shared<string_response>("Id must be an integer!", 400, "text/plain");
+                return std::make_shared<body_response>("Id must be an integer!", 400, "text/plain");
 
             uint16_t id_val;
             std::from_chars(id.c_str(), id.c_str() + id.size(), id_val);
@@ -81,7 +86,7 @@ namespace resources::model
             {
                 cursor.close();
                 rtxn.abort();
-                return std::make_shared<string_response>("Could not find a user with that id!", 404, "text/plain");
+                return std::make_shared<body_response>("Could not find a user with that id!", 404, "text/plain");
             }
 
             auto* raw = (uint8_t*)result.mv_data;
@@ -100,24 +105,38 @@ namespace resources::model
         cursor.close();
         rtxn.abort();
 
-        return std::make_shared<string_response>(builder.serialize(), 200, "application/xml");
+        return std::make_shared<body_response>(builder.serialize(), 200, DocumentWriter::content_type(*format));
     }
 
-    const Ref<http_response> get_transaction_types::process(const http_request&)
+    get_transaction_types::get_transaction_types(const Ref<Statistics>& stat_data)
+        : clean_resource("/transaction_types", true, stat_data)
     {
-        XmlBuilder builder;
+        for (auto format : { OutputFormat::Xml, OutputFormat::Json })
+        {
+            auto writer = DocumentWriter::create(format, false);
+            auto& builder = *writer;
 
-        builder
-            .add_signature()
-            .add_child("Data")
-                .add_array("TransactionTypes", {
-                    models::TransactionType::Swipe,
-                    models::TransactionType::Online,
-                    models::TransactionType::Chip
-                }, [](XmlBuilder& b, const auto& t) -> void {
-                    b.add_string("TransactionType", models::transaction_type_to_string(t));
-                });
-
-        return std::make_shared<string_response>(builder.serialize(), 200, "application/xml");
+            builder
+                .add_signature()
+                .add_child("Data")
+                    .add_array("TransactionTypes", {
+                        models::TransactionType::Swipe,
+                        models::TransactionType::Online,
+                        models::TransactionType::Chip
+                    }, [](DocumentWriter& b, const auto& t) -> void {
+                        b.add_string("TransactionType", models::transaction_type_to_string(t));
+                    });
+
+            p_documents[(size_t)format] = StaticDocument(builder.serialize(), DocumentWriter::content_type(format));
+        }
+    }
+
+    const Ref<http_response> get_transaction_types::process(const http_request& req)
+    {
+        auto format = util::negotiate_format(req);
+        if (!format || *format == OutputFormat::Arrow)
+            return std::make_shared<body_response>("Format must be either xml or json!", 400, "text/plain");
+
+        return p_documents[(size_t)*format].response(compression::negotiate(req));
     }
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 #include <spdlog/spdlog.h>
 
 #include "helpers/utilities.hpp"
-#include "helpers/xml_builder.hpp"
+#include "helpers/signer.hpp"
 
 namespace resources
 {
@@ -14,7 +14,7 @@ namespace resources
             std::make_shared<empty_test>(stat_data),
             std::make_shared<big_workload>(stat_data),
             std::make_shared<model::get_user>(stat_data, env),
-            std::make_shared<model::get_transaction_types>(stat_data, env),
+            std::make_shared<model::get_transaction_types>(stat_data),
             std::make_shared<analytics::queries>(stat_data, env)
         };
     }
@@ -22,8 +22,6 @@ namespace resources
     const Ref<http_response> digest_test::process(const http_request& req)
     {
         using httpserver::digest_auth_fail_response;
-        using httpserver::string_response;
-
         if (req.get_digested_user().empty())
         {
             push_access(AccessData { req.get_requestor(), std::string{}, AccessStatus::NoUserProvided });
@@ -40,13 +38,11 @@ namespace resources
         }
 
         push_access(AccessData { req.get_requestor(), req.get_digested_user(), AccessStatus::Success });
-        return std::make_shared<string_response>("SUCCESS!", 200, "text/plain");
+        return std::make_shared<body_response>("SUCCESS!", 200, "text/plain");
     }
 
     const Ref<http_response> echo_test::process(const http_request& req)
     {
-        using httpserver::string_response;
-
         std::stringstream ss;
         ss << "Method: " << req.get_method() << "\n";
         ss << "Path: " << req.get_path() << "\n";
@@ -66,20 +62,19 @@ namespace resources
             ss << "\t" << cookie.first << ": " << cookie.second << "\n";
         }
 
-        return std::make_shared<string_response>(ss.str(), 200, "text/plain");
+        return std::make_shared<body_response>(ss.str(), 200, "text/plain");
     }
 
     const Ref<http_response> empty_test::process(const http_request&)
     {
-        return std::make_shared<httpserver::string_response>("", 200, "text/plain");
+        return std::make_shared<body_response>("", 200, "text/plain");
     }
 
     const Ref<http_response> big_workload::process(const http_request&)
     {
         using namespace std::literals::chrono_literals;
-        using httpserver::string_response;
 
         std::this_thread::sleep_for(5s);
-        return std::make_shared<string_response>("Complete!", 200, "text/plain");
+        return std::make_shared<body_response>("Complete!", 200, "text/plain");
     }
 }
@@ -2,10 +2,12 @@
 
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <nlohmann/json.hpp>
 
 #include "helpers/env.hpp"
 #include "helpers/popl.hpp"
+#include "resources.hpp"
 
 namespace fs = std::filesystem;
 
@@ -24,7 +26,14 @@ namespace fs = std::filesystem;
  *      "certificate": string,
  *      "private_key": string,
  *      "document_certificate": string,
- *      "document_private_key": string
+ *      "document_private_key": string,
+ *      "signature_algorithm": string,
+ *      "denormalize": [string],
+ *      "compression_level": int,
+ *      "result_cache_size": int,
+ *      "cache_size": int,
+ *      "cache_sync": string,
+ *      "prewarm": string
  * }
  * @endcode
  * @param file Path to the json config file to process.
@@ -57,10 +66,33 @@ ServerOptions parse_options_from_file(const fs::path& file)
     opts.private_key = get_or_default("private_key", opts.private_key);
     opts.document_certificate = get_or_default("document_certificate", opts.certificate);
     opts.document_private_key = get_or_default("document_private_key", opts.private_key);
+    opts.signature_algorithm = get_or_default("signature_algorithm", opts.signature_algorithm);
+    opts.denormalize = get_or_default("denormalize", opts.denormalize);
+    opts.compression_level = get_or_default("compression_level", opts.compression_level);
+    opts.result_cache_size = get_or_default("result_cache_size", opts.result_cache_size);
+    opts.cache_size = get_or_default("cache_size", opts.cache_size);
+    opts.cache_sync = get_or_default("cache_sync", opts.cache_sync);
+    opts.prewarm = get_or_default("prewarm", opts.prewarm);
 
     return opts;
 }
 
+/**
+ * Splits a comma separated list, ignoring empty entries.
+ */
+std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream iss{list};
+    std::string item;
+    while (std::getline(iss, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
 ServerOptions parse_options(int argc, const char** argv)
 {
     ServerOptions options;
@@ -82,6 +114,14 @@ ServerOptions parse_options(int argc, const char** argv)
     options.private_key = env::get_string("UTOPIA_PRIVATE_KEY", options.private_key);
     options.document_certificate = env::get_string("UTOPIA_DOCUMENT_CERTIFICATE", options.document_certificate);
     options.document_private_key = env::get_string("UTOPIA_DOCUMENT_PRIVATE_KEY", options.document_private_key);
+    options.signature_algorithm = env::get_string("UTOPIA_SIGNATURE_ALGORITHM", options.signature_algorithm.c_str());
+    if (auto denormalize = env::get_string("UTOPIA_DENORMALIZE"))
+        options.denormalize = split_list(*denormalize);
+    options.compression_level = env::get_int("UTOPIA_COMPRESSION_LEVEL", options.compression_level);
+    options.result_cache_size = env::get_int("UTOPIA_RESULT_CACHE_SIZE", options.result_cache_size);
+    options.cache_size = env::get_int("UTOPIA_CACHE_SIZE", options.cache_size);
+    options.cache_sync = env::get_string("UTOPIA_CACHE_SYNC", options.cache_sync.c_str());
+    options.prewarm = env::get_string("UTOPIA_PREWARM", options.prewarm.c_str());
 
     popl::OptionParser op("OPTIONS");
     auto help_opt = op.add<popl::Switch>("h", "help", "show this message");
@@ -97,6 +137,13 @@ ServerOptions parse_options(int argc, const char** argv)
     auto noipv6_opt = op.add<popl::Switch>("", "no-ipv6", "disallow IPv6 connections");
     auto cert_opt = op.add<popl::Value<std::string>>("C", "cert", "certificate to authenticate with");
     auto key_opt = op.add<popl::Value<std::string>>("K", "key", "private key for the certificate");
+    auto denorm_opt = op.add<popl::Value<std::string>>("", "denormalize", "comma separated dimension attributes to copy next to transactions");
+    auto compress_opt = op.add<popl::Value<uint16_t>>("", "compression-level", "gzip/zstd level for responses, 0 to disable");
+    auto sig_alg_opt = op.add<popl::Value<std::string>>("", "signature-algorithm", "document signature algorithm: dsa-sha1, ecdsa-sha256 or ed25519");
+    auto result_cache_opt = op.add<popl::Value<uint16_t>>("", "result-cache-size", "MiB of query responses to keep in memory, 0 to disable");
+    auto cache_size_opt = op.add<popl::Value<uint16_t>>("", "cache-size", "MiB of query responses to keep on disk, 0 to disable");
+    auto cache_sync_opt = op.add<popl::Value<std::string>>("", "cache-sync", "when cached responses are flushed to disk: always, periodic or never");
+    auto prewarm_opt = op.add<popl::Value<std::string>>("", "prewarm", "JSON list of queries to compute in the background at startup");
     op.parse(argc, argv);
 
     if (help_opt->is_set())
@@ -133,6 +180,20 @@ ServerOptions parse_options(int argc, const char** argv)
         options.max_threads = thread_opt->value();
     if (tpc_opt->is_set())
         options.thread_per_connection = true;
+    if (denorm_opt->is_set())
+        options.denormalize = split_list(denorm_opt->value());
+    if (compress_opt->is_set())
+        options.compression_level = compress_opt->value();
+    if (sig_alg_opt->is_set())
+        options.signature_algorithm = sig_alg_opt->value();
+    if (result_cache_opt->is_set())
+        options.result_cache_size = result_cache_opt->value();
+    if (cache_size_opt->is_set())
+        options.cache_size = cache_size_opt->value();
+    if (cache_sync_opt->is_set())
+        options.cache_sync = cache_sync_opt->value();
+    if (prewarm_opt->is_set())
+        options.prewarm = prewarm_opt->value();
 
     if (noipv4_opt->is_set())
         options.use_ipv4 = false;
@@ -150,5 +211,16 @@ ServerOptions parse_options(int argc, const char** argv)
     if (!options.use_ipv4 && !options.use_ipv6)
         throw std::invalid_argument("both ipv4 and ipv6 are disallowed, so no connections can be made!");
 
+    resources::analytics::validate_join_columns(options.denormalize);
+
+    if (options.signature_algorithm != "dsa-sha1" && options.signature_algorithm != "ecdsa-sha256" && options.signature_algorithm != "ed25519")
+        throw std::invalid_argument("\"" + options.signature_algorithm + "\" isn't a signature algorithm, expected dsa-sha1, ecdsa-sha256 or ed25519!");
+
+    if (options.compression_level > 9)
+        throw std::invalid_argument("compression level must be between 0 and 9!");
+
+    if (options.cache_sync != "always" && options.cache_sync != "periodic" && options.cache_sync != "never")
+        throw std::invalid_argument("\"" + options.cache_sync + "\" isn't a cache sync policy, expected always, periodic or never!");
+
     return options;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <optional>
 
 /**
@@ -30,6 +31,19 @@ struct ServerOptions
     std::optional<std::string> private_key;
     std::optional<std::string> document_certificate;
     std::optional<std::string> document_private_key;
+    // dsa-sha1, ecdsa-sha256 or ed25519, the key has to match
+    std::string signature_algorithm = "dsa-sha1";
+    std::vector<std::string> denormalize;
+    // 0 turns response compression off, otherwise 1 (fastest) to 9 (smallest)
+    uint16_t compression_level = 6;
+    // MiB of query responses to keep in memory, 0 turns the result cache off
+    uint16_t result_cache_size = 256;
+    // MiB of query responses to keep on disk in cache.mdb, 0 turns the cache store off
+    uint16_t cache_size = 2048;
+    // When the cache store flushes writes to the disk: always, periodic or never
+    std::string cache_sync = "always";
+    // JSON list of queries to compute in the background at startup, empty for none
+    std::string prewarm;
 };
 
 /**
@@ -8,8 +8,12 @@
 
 #include "server_opts.hpp"
 #include "resources.hpp"
+#include "dimensions.hpp"
 #include "helpers/utilities.hpp"
-#include "helpers/xml_builder.hpp"
+#include "helpers/signer.hpp"
+#include "helpers/compression.hpp"
+#include "helpers/cache_store.hpp"
+#include "helpers/formatting.hpp"
 #include "monitors/perf_monitor.hpp"
 #include "monitors/stat_monitor.hpp"
 
@@ -70,7 +74,15 @@ int utopia::run(int argc, const char** argv)
     {
         std::string cert = util::read_file(*opts.document_certificate);
         std::string priv = util::read_file(*opts.document_private_key);
-        XmlBuilder::initialize_signing(cert, priv);
+        try
+        {
+            DocumentSigner::initialize(cert, priv, opts.signature_algorithm);
+        }
+        catch (std::invalid_argument& ex)
+        {
+            spdlog::critical("{}", ex.what());
+            return 1;
+        }
     }
 
     if (opts.thread_per_connection)
@@ -112,6 +124,22 @@ int utopia::run(int argc, const char** argv)
         return 1;
     }
 
+    dimensions::initialize(*env);
+    resources::analytics::configure_join_columns(opts.denormalize);
+    resources::analytics::configure_result_cache((size_t)opts.result_cache_size * 1024 * 1024);
+    try
+    {
+        CacheStore::initialize("cache.mdb", (size_t)opts.cache_size * 1024 * 1024, resources::analytics::dataset_fingerprint(*env),
+                               CacheStore::sync_policy(opts.cache_sync));
+    }
+    catch (std::exception& ex)
+    {
+        spdlog::critical("Unable to open the cache store at `cache.mdb`: {}", ex.what());
+        return 1;
+    }
+    compression::configure(opts.compression_level);
+    formatting::initialize();
+
     httpserver::webserver ws = builder;
     auto resource_list = resources::resources(perf_data, stat_data, env);
     for (auto& resource : resource_list)
@@ -122,6 +150,9 @@ int utopia::run(int argc, const char** argv)
     spdlog::info("Starting server on port {}...", opts.port);
     ws.start();
 
+    if (!opts.prewarm.empty())
+        resources::analytics::prewarm(opts.prewarm, env);
+
     std::mutex sig_mtx;
     std::unique_lock<std::mutex> lock(sig_mtx);
     signal_cv.wait(lock);
@@ -131,6 +162,9 @@ int utopia::run(int argc, const char** argv)
     if (ws.is_running())
         ws.sweet_kill();
 
+    resources::analytics::stop_background_work();
+    CacheStore::shutdown();
+
     perf_data->should_close = true;
     stat_data->should_close = true;
 